@@ -0,0 +1,287 @@
+#include "vision.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <zlib.h>
+
+#ifdef _WIN32
+#define fseek64 _fseeki64
+#else
+#define fseek64 fseeko
+#endif
+
+// brick volume file: 64 bytes header & size^3 voxels bricks in z, y, x brick order, border bricks padded with 0
+// compressed brick volume file: 64 bytes header, count+1 offsets index & deflated bricks in the same order
+struct BrickHeader {
+    char Magic[8];
+    unsigned long long Width, Height, Depth, Size;
+    float Thickness;
+    char Reserved[20];
+};
+
+Bricks::Bricks()
+    : _file(0), _width(0), _height(0), _depth(0), _thickness(1.0f),
+    _size(64), _nx(0), _ny(0), _nz(0), _capacity(0), _compress(false)
+{
+    omp_init_lock(&_lock);
+}
+
+Bricks::~Bricks()
+{
+    Close();
+    omp_destroy_lock(&_lock);
+}
+
+bool Bricks::Open(const char *path, size_t capacity)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == 0) {
+        printf("[Bricks::Open] open brick volume file %s failed\n", path);
+        return false;
+    }
+
+    BrickHeader header;
+    bool compress = false;
+    if (fread(&header, sizeof(BrickHeader), 1, file) != 1 || header.Size == 0 ||
+        !(memcmp(header.Magic, "FLNBRK01", 8) == 0 || (compress = memcmp(header.Magic, "FLNBRK02", 8) == 0))) {
+        printf("[Bricks::Open] brick volume file %s has an unsupported header\n", path);
+        fclose(file);
+        return false;
+    }
+
+    size_t count = (size_t)(((header.Width+header.Size-1)/header.Size)*((header.Height+header.Size-1)/header.Size)*((header.Depth+header.Size-1)/header.Size));
+    std::vector<unsigned long long> index;
+    if (compress) {
+        index.resize(count+1);
+        if (fread(&index[0], sizeof(unsigned long long), count+1, file) != count+1) {
+            printf("[Bricks::Open] brick volume file %s has a broken index\n", path);
+            fclose(file);
+            return false;
+        }
+    }
+
+    Close();
+    _file = file;
+    _compress = compress;
+    _index.swap(index);
+    _width = (size_t)header.Width;
+    _height = (size_t)header.Height;
+    _depth = (size_t)header.Depth;
+    _thickness = (header.Thickness > 0.0f) ? header.Thickness : 1.0f;
+    _size = (size_t)header.Size;
+    _nx = (_width+_size-1)/_size;
+    _ny = (_height+_size-1)/_size;
+    _nz = (_depth+_size-1)/_size;
+    _capacity = std::max(capacity/(_size*_size*_size), (size_t)8);
+    _table.assign(_nx*_ny*_nz, (unsigned char*)0);
+    _where.resize(_nx*_ny*_nz);
+    printf("[Bricks::Open] open %sbrick volume file %s ok, %d bricks, cache %d bricks\n", _compress ? "compressed " : "", path, (int)_table.size(), (int)_capacity);
+    return true;
+}
+
+void Bricks::Close()
+{
+    for (std::list<size_t>::iterator it=_list.begin(); it!=_list.end(); ++it) delete[] _table[*it];
+    _list.clear();
+    _table.clear();
+    _where.clear();
+    _index.clear();
+    _packed.clear();
+    if (_file != 0) fclose(_file);
+    _file = 0;
+    _width = _height = _depth = _nx = _ny = _nz = 0;
+}
+
+bool Bricks::Write(const char *path, const unsigned char *buffer, size_t width, size_t height, size_t depth, float thickness, size_t size, bool compress)
+{
+    if (buffer == 0 || size == 0) return false;
+
+    FILE *file = fopen(path, "wb");
+    if (file == 0) {
+        printf("[Bricks::Write] open brick volume file %s failed\n", path);
+        return false;
+    }
+
+    clock_t t = clock();
+    BrickHeader header;
+    memset(&header, 0, sizeof(BrickHeader));
+    memcpy(header.Magic, compress ? "FLNBRK02" : "FLNBRK01", 8);
+    header.Width = width;
+    header.Height = height;
+    header.Depth = depth;
+    header.Size = size;
+    header.Thickness = thickness;
+    bool ok = fwrite(&header, sizeof(BrickHeader), 1, file) == 1;
+
+    // index is written after bricks once compressed lengths are known
+    size_t nx = (width+size-1)/size, ny = (height+size-1)/size, nz = (depth+size-1)/size;
+    std::vector<unsigned long long> index(compress ? nx*ny*nz+1 : 0);
+    unsigned long long offset = sizeof(BrickHeader) + index.size()*sizeof(unsigned long long);
+    if (compress) ok = ok && fseek64(file, offset, SEEK_SET) == 0;
+
+    // bricks of one z layer are gathered & compressed in parallel, then written in order
+    size_t bytes = size*size*size;
+    std::vector<std::vector<unsigned char> > layer(nx*ny);
+    for (size_t bz=0; bz<nz && ok; ++bz) {
+        #pragma omp parallel for schedule(dynamic)
+        for (int i=0; i<(int)(nx*ny); ++i) {
+            std::vector<unsigned char> brick(bytes, 0);
+            size_t x0 = (i%nx)*size, y0 = (i/nx)*size, z0 = bz*size;
+            size_t w = std::min(size, width-x0), h = std::min(size, height-y0), d = std::min(size, depth-z0);
+            for (size_t z=0; z<d; ++z)
+                for (size_t y=0; y<h; ++y)
+                    memcpy(&brick[(z*size+y)*size], buffer+((z0+z)*height+y0+y)*width+x0, w);
+            if (compress) {
+                uLongf length = compressBound((uLong)bytes);
+                layer[i].resize(length);
+                if (compress2(&layer[i][0], &length, &brick[0], (uLong)bytes, Z_BEST_SPEED) != Z_OK) length = 0;
+                layer[i].resize(length);
+            }
+            else layer[i].swap(brick);
+        }
+        for (size_t i=0; i<nx*ny && ok; ++i) {
+            ok = !layer[i].empty() && fwrite(&layer[i][0], 1, layer[i].size(), file) == layer[i].size();
+            if (compress) index[bz*nx*ny+i] = offset;
+            offset += layer[i].size();
+        }
+    }
+    if (compress && ok) {
+        index[nx*ny*nz] = offset;
+        ok = fseek64(file, sizeof(BrickHeader), SEEK_SET) == 0 && fwrite(&index[0], sizeof(unsigned long long), index.size(), file) == index.size();
+    }
+    fclose(file);
+    if (!ok) {
+        printf("[Bricks::Write] write brick volume file %s failed\n", path);
+        return false;
+    }
+    printf("[Bricks::Write] write brick volume file %s ok (%ld ms, %.1fx)\n", path, clock()-t, (double)width*height*depth/offset);
+    return true;
+}
+
+unsigned char Bricks::GetVoxel(size_t x, size_t y, size_t z)
+{
+    if (_file == 0 || x >= _width || y >= _height || z >= _depth) return 0;
+
+    omp_set_lock(&_lock);
+    const unsigned char *brick = Load(((z/_size)*_ny + y/_size)*_nx + x/_size);
+    unsigned char v = brick[((z%_size)*_size + y%_size)*_size + x%_size];
+    omp_unset_lock(&_lock);
+    return v;
+}
+
+void Bricks::GetRegion(unsigned char *region, size_t x0, size_t y0, size_t z0, size_t x1, size_t y1, size_t z1)
+{
+    if (_file == 0 || region == 0 || x1 >= _width || y1 >= _height || z1 >= _depth || x0 > x1 || y0 > y1 || z0 > z1) return;
+
+    size_t width = x1-x0+1, height = y1-y0+1;
+    omp_set_lock(&_lock);
+    for (size_t bz=z0/_size; bz<=z1/_size; ++bz) {
+        for (size_t by=y0/_size; by<=y1/_size; ++by) {
+            for (size_t bx=x0/_size; bx<=x1/_size; ++bx) {
+                const unsigned char *brick = Load((bz*_ny + by)*_nx + bx);
+                size_t sx = std::max(x0, bx*_size), ex = std::min(x1, bx*_size+_size-1);
+                size_t sy = std::max(y0, by*_size), ey = std::min(y1, by*_size+_size-1);
+                size_t sz = std::max(z0, bz*_size), ez = std::min(z1, bz*_size+_size-1);
+                for (size_t z=sz; z<=ez; ++z)
+                    for (size_t y=sy; y<=ey; ++y)
+                        memcpy(region+((z-z0)*height+y-y0)*width+sx-x0, brick+((z-bz*_size)*_size+y-by*_size)*_size+sx-bx*_size, ex-sx+1);
+            }
+        }
+    }
+    omp_unset_lock(&_lock);
+}
+
+void Bricks::Prefetch(size_t x0, size_t y0, size_t z0, size_t x1, size_t y1, size_t z1)
+{
+    if (_file == 0) return;
+
+    x1 = std::min(x1, _width-1);
+    y1 = std::min(y1, _height-1);
+    z1 = std::min(z1, _depth-1);
+    if (x0 > x1 || y0 > y1 || z0 > z1) return;
+
+    // bricks ids follow file order, so missing bricks are read in ascending offsets
+    omp_set_lock(&_lock);
+    size_t count = 0;
+    for (size_t bz=z0/_size; bz<=z1/_size && count<_capacity/2; ++bz)
+        for (size_t by=y0/_size; by<=y1/_size && count<_capacity/2; ++by)
+            for (size_t bx=x0/_size; bx<=x1/_size && count<_capacity/2; ++bx, ++count)
+                Load((bz*_ny + by)*_nx + bx);
+    omp_unset_lock(&_lock);
+}
+
+void Bricks::GetSample(unsigned char *sample, size_t level)
+{
+    if (_file == 0 || sample == 0 || level == 0) return;
+
+    // stream every brick once bypassing the cache, keep maximum of each level^3 cell for MIP
+    size_t width = (_width+level-1)/level, height = (_height+level-1)/level, depth = (_depth+level-1)/level;
+    memset(sample, 0, width*height*depth);
+    unsigned char *brick = new unsigned char[_size*_size*_size];
+    omp_set_lock(&_lock);
+    for (size_t bz=0; bz<_nz; ++bz) {
+        for (size_t by=0; by<_ny; ++by) {
+            for (size_t bx=0; bx<_nx; ++bx) {
+                Fetch((bz*_ny + by)*_nx + bx, brick);
+                size_t x0 = bx*_size, y0 = by*_size, z0 = bz*_size;
+                size_t w = std::min(_size, _width-x0), h = std::min(_size, _height-y0), d = std::min(_size, _depth-z0);
+                for (size_t z=0; z<d; ++z) {
+                    for (size_t y=0; y<h; ++y) {
+                        unsigned char *dst = sample + ((z0+z)/level*height + (y0+y)/level)*width;
+                        const unsigned char *src = brick + (z*_size+y)*_size;
+                        for (size_t x=0; x<w; ++x) {
+                            unsigned char &v = dst[(x0+x)/level];
+                            if (src[x] > v) v = src[x];
+                        }
+                    }
+                }
+            }
+        }
+    }
+    omp_unset_lock(&_lock);
+    delete[] brick;
+}
+
+const unsigned char *Bricks::Load(size_t id)
+{
+    unsigned char *brick = _table[id];
+    if (brick != 0) {
+        _list.splice(_list.begin(), _list, _where[id]);
+        return brick;
+    }
+
+    // evict the least recently used brick and reuse its memory
+    if (_list.size() >= _capacity) {
+        size_t last = _list.back();
+        _list.pop_back();
+        brick = _table[last];
+        _table[last] = 0;
+    }
+    else brick = new unsigned char[_size*_size*_size];
+
+    Fetch(id, brick);
+    _table[id] = brick;
+    _list.push_front(id);
+    _where[id] = _list.begin();
+    return brick;
+}
+
+void Bricks::Fetch(size_t id, unsigned char *brick)
+{
+    size_t bytes = _size*_size*_size;
+    if (!_compress) {
+        if (fseek64(_file, sizeof(BrickHeader) + (long long)id*bytes, SEEK_SET) != 0 || fread(brick, 1, bytes, _file) != bytes)
+            memset(brick, 0, bytes);
+        return;
+    }
+
+    // only this brick is read & inflated
+    size_t length = (size_t)(_index[id+1]-_index[id]);
+    uLongf size = (uLongf)bytes;
+    _packed.resize(std::max(length, (size_t)1));
+    if (fseek64(_file, (long long)_index[id], SEEK_SET) != 0 || fread(&_packed[0], 1, length, _file) != length ||
+        uncompress(brick, &size, &_packed[0], (uLong)length) != Z_OK || size != bytes)
+        memset(brick, 0, bytes);
+}
@@ -91,7 +91,7 @@ void View::ParsePaste(const char *text)
     strcpy(ext, fl_filename_ext(path));
     _strlwr(ext);
 
-    if (strcmp(ext, ".tif") == 0) {
+    if (strcmp(ext, ".tif") == 0 || strcmp(ext, ".vol") == 0 || strcmp(ext, ".brk") == 0 || strcmp(ext, ".bkz") == 0) {
         char str[256];
         sprintf(str, "flNeuronTool Editor - loading %s ...", fl_filename_name(path));
         window()->label(str);
@@ -134,7 +134,7 @@ void View::ParsePaste(const char *text)
         return;
     }
 
-    fl_alert("Unknown file type. \nSupport volume (TIFF), soma (APO), tree (SWC) file.\n");
+    fl_alert("Unknown file type. \nSupport volume (TIFF, VOL, BRK, BKZ), soma (APO), tree (SWC) file.\n");
 }
 
 void View::SelectObject(int winx, int winy)
@@ -265,13 +265,13 @@ void View::FileLoad()
     Fl_Native_File_Chooser fc;
     fc.title("Load File");
     fc.type(Fl_Native_File_Chooser::BROWSE_FILE);
-    fc.filter("Volume File (*.tif)\t*.{tif}\nSoma File (*.apo)\t*.{apo}\nTree File (*.swc)\t*.{swc}\n");
+    fc.filter("Volume File (*.tif)\t*.{tif}\nSoma File (*.apo)\t*.{apo}\nTree File (*.swc)\t*.{swc}\nRaw Volume File (*.vol)\t*.{vol}\nBrick Volume File (*.brk)\t*.{brk}\nCompressed Brick Volume File (*.bkz)\t*.{bkz}\n");
     if (fc.show() == 0) {
         char path[256], ext[5];
         strcpy(path, fc.filename());
         strcpy(ext, fl_filename_ext(path));
         _strlwr(ext);
-        if (strcmp(ext, ".tif") == 0) {
+        if (strcmp(ext, ".tif") == 0 || strcmp(ext, ".vol") == 0 || strcmp(ext, ".brk") == 0 || strcmp(ext, ".bkz") == 0) {
             char str[256];
             sprintf(str, "flNeuronTool Editor - loading %s ...", fl_filename_name(path));
             window()->label(str);
@@ -314,7 +314,7 @@ void View::FileLoad()
             return;
         }
 
-        fl_alert("Unknown file type. \nSupport volume (TIFF), soma (APO), tree (SWC) file.\n");
+        fl_alert("Unknown file type. \nSupport volume (TIFF, VOL, BRK, BKZ), soma (APO), tree (SWC) file.\n");
     }
 }
 
@@ -329,7 +329,7 @@ void View::FileSave()
     fc.title("Save File");
     fc.type(Fl_Native_File_Chooser::BROWSE_SAVE_FILE);
     fc.options(fc.options() | Fl_Native_File_Chooser::SAVEAS_CONFIRM);
-    fc.filter("Volume File (*.tif)\t*.{tif}\nSoma File (*.apo)\t*.{apo}\nTree File (*.swc)\t*.{swc}\n");
+    fc.filter("Volume File (*.tif)\t*.{tif}\nSoma File (*.apo)\t*.{apo}\nTree File (*.swc)\t*.{swc}\nRaw Volume File (*.vol)\t*.{vol}\nBrick Volume File (*.brk)\t*.{brk}\nCompressed Brick Volume File (*.bkz)\t*.{bkz}\n");
     if (fc.show() == 0) {
         char path[256];
         strcpy(path, fc.filename());
@@ -360,7 +360,22 @@ void View::FileSave()
             tree.Write(path);
             return;
         }
-        fl_alert("Unknown file type. Support volume (TIFF), soma (APO), tree (SWC) file.\n");
+        if (fit == 3) {
+            strcat(path, ".vol");
+            _volume->Write(path);
+            return;
+        }
+        if (fit == 4) {
+            strcat(path, ".brk");
+            _volume->Write(path);
+            return;
+        }
+        if (fit == 5) {
+            strcat(path, ".bkz");
+            _volume->Write(path);
+            return;
+        }
+        fl_alert("Unknown file type. Support volume (TIFF, VOL, BRK, BKZ), soma (APO), tree (SWC) file.\n");
     }
 }
 
@@ -1,6 +1,9 @@
 #pragma once
 
 #include <vector>
+#include <list>
+#include <stdio.h>
+#include <omp.h>
 
 struct IVision {
     virtual ~IVision() {}
@@ -10,11 +13,49 @@ struct IVision {
     virtual void Show() const = 0;
 };
 
+class Bricks { // BRK, out-of-core volume paged in size^3 bricks by a LRU cache, optionally deflated per brick
+public:
+    Bricks();
+    ~Bricks();
+
+    bool Open(const char *path, size_t capacity);
+    void Close();
+    static bool Write(const char *path, const unsigned char *buffer, size_t width, size_t height, size_t depth, float thickness, size_t size=64, bool compress=false);
+
+    bool IsValid() const { return _file != 0; }
+    bool IsCompressed() const { return _compress; }
+    size_t GetWidth() const { return _width; }
+    size_t GetHeight() const { return _height; }
+    size_t GetDepth() const { return _depth; }
+    float GetThickness() const { return _thickness; }
+    size_t GetResident() const { return _list.size(); }
+    unsigned char GetVoxel(size_t x, size_t y, size_t z);
+    void GetRegion(unsigned char *region, size_t x0, size_t y0, size_t z0, size_t x1, size_t y1, size_t z1);
+    void Prefetch(size_t x0, size_t y0, size_t z0, size_t x1, size_t y1, size_t z1);
+    void GetSample(unsigned char *sample, size_t level);
+
+private:
+    const unsigned char *Load(size_t id); // lock held by caller
+    void Fetch(size_t id, unsigned char *brick); // lock held by caller
+
+    FILE *_file;
+    size_t _width, _height, _depth;
+    float _thickness;
+    size_t _size, _nx, _ny, _nz, _capacity;
+    bool _compress;
+    std::vector<unsigned long long> _index; // compressed bricks file offsets, count+1
+    std::vector<unsigned char> _packed;
+    std::vector<unsigned char*> _table; // resident bricks data by id, 0 if paged out
+    std::vector<std::list<size_t>::iterator> _where;
+    std::list<size_t> _list; // resident bricks ids, most recently used first
+    omp_lock_t _lock;
+};
+
 enum VOL_STYLE { VOL_NONE, VOL_MIP, VOL_ACCUM, VOL_BLEND };
 
 class Volume : public IVision { // TIFF
 public:
-    Volume() : _buffer(0), _width(0), _height(0), _depth(0), _thickness(1.0f), _scale(1.0f), _offx(0), _offy(0), _offz(0), _texture(0), _flip(false), _bound(true), _style(VOL_MIP) {}
+    Volume() : _buffer(0), _map(0), _length(0), _width(0), _height(0), _depth(0), _thickness(1.0f), _scale(1.0f), _offx(0), _offy(0), _offz(0), _texture(0), _flip(false), _bound(true), _style(VOL_MIP) {}
     ~Volume();
 
     bool Read(const char *path);
@@ -41,7 +82,17 @@ public:
     void SetSample(int level) const;
 
 private:
-    unsigned char *_buffer;
+    static bool IsType(const char *path, const char *ext);
+    bool ReadTIFF(const char *path);
+    bool ReadRaw(const char *path);
+    bool ReadBrick(const char *path);
+    bool WriteTIFF(const char *path) const;
+    bool WriteRaw(const char *path) const;
+    void Release();
+
+private:
+    unsigned char *_buffer, *_map; // _map is the raw file mapping when _buffer points into it
+    size_t _length;
     size_t _width, _height, _depth;
     float _thickness, _scale;
     int _offx, _offy, _offz;
@@ -2,20 +2,84 @@
 
 #include <stdio.h>
 #include <math.h>
+#include <ctype.h>
+#include <time.h>
 #include <omp.h>
 #include <GL/glew.h>
 #include <glm/glm.hpp>
 #include <tiffio.h>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 Volume::~Volume()
 {
-    if (_buffer != 0) delete[] _buffer;
+    Release();
     if (glIsTexture(_texture)) glDeleteTextures(1, &_texture);
     _buffer = 0;
     _texture = 0;
 }
 
-bool Volume::Read(const char *path)
+// decode current 8 bits gray directory by strips or tiles into slice, return false for RGBA fallback
+static bool ReadSlice(TIFF *tif, uint8 *slice, uint32 width, uint32 height)
+{
+    uint16 photo=1, channels=1, bits=8, planar=PLANARCONFIG_CONTIG, orient=ORIENTATION_TOPLEFT;
+    uint32 w=0, h=0;
+    TIFFGetField(tif, TIFFTAG_PHOTOMETRIC, &photo);
+    TIFFGetFieldDefaulted(tif, TIFFTAG_SAMPLESPERPIXEL, &channels);
+    TIFFGetFieldDefaulted(tif, TIFFTAG_BITSPERSAMPLE, &bits);
+    TIFFGetFieldDefaulted(tif, TIFFTAG_PLANARCONFIG, &planar);
+    TIFFGetFieldDefaulted(tif, TIFFTAG_ORIENTATION, &orient);
+    TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &w);
+    TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &h);
+    if (photo > PHOTOMETRIC_MINISBLACK || channels != 1 || bits != 8 || planar != PLANARCONFIG_CONTIG) return false;
+    if (orient != ORIENTATION_TOPLEFT || w != width || h != height) return false;
+
+    if (TIFFIsTiled(tif)) {
+        uint32 tw=0, th=0;
+        TIFFGetField(tif, TIFFTAG_TILEWIDTH, &tw);
+        TIFFGetField(tif, TIFFTAG_TILELENGTH, &th);
+        if (tw == 0 || th == 0) return false;
+        uint8 *tile = new uint8[TIFFTileSize(tif)];
+        for (uint32 y=0; y<height; y+=th) {
+            for (uint32 x=0; x<width; x+=tw) {
+                if (TIFFReadEncodedTile(tif, TIFFComputeTile(tif, x, y, 0, 0), tile, TIFFTileSize(tif)) < 0) {
+                    delete[] tile;
+                    return false;
+                }
+                uint32 rows = (y+th>height) ? (height-y) : th;
+                uint32 cols = (x+tw>width) ? (width-x) : tw;
+                for (uint32 j=0; j<rows; ++j)
+                    memcpy(slice+(size_t)(y+j)*width+x, tile+(size_t)j*tw, cols);
+            }
+        }
+        delete[] tile;
+    }
+    else {
+        uint32 rps = height;
+        TIFFGetFieldDefaulted(tif, TIFFTAG_ROWSPERSTRIP, &rps);
+        if (rps == 0 || rps > height) rps = height;
+        uint32 strips = TIFFNumberOfStrips(tif);
+        for (uint32 s=0; s<strips && s*rps<height; ++s) {
+            uint32 rows = (s*rps+rps>height) ? (height-s*rps) : rps;
+            if (TIFFReadEncodedStrip(tif, s, slice+(size_t)s*rps*width, (tmsize_t)rows*width) < 0) return false;
+        }
+    }
+
+    if (photo == PHOTOMETRIC_MINISWHITE) {
+        for (size_t j=0; j<(size_t)width*height; ++j) slice[j] = 255-slice[j];
+    }
+    return true;
+}
+
+bool Volume::ReadTIFF(const char *path)
 {
     TIFFSetWarningHandler(0);
     TIFF *tif = TIFFOpen(path, "rb");
@@ -37,26 +101,58 @@ bool Volume::Read(const char *path)
     uint32 width=0, height=0;
     TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &width);
     TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &height);
-    uint16 depth = TIFFNumberOfDirectories(tif);
-    uint8 *buffer = new uint8[width*height*depth];
-    uint32 *slice = new uint32[width*height]; 
-    for (uint16 i=0; i<depth; ++i) {
-        // assert bits, channels, photometric & width, height
-        TIFFReadRGBAImageOriented(tif, width, height, slice, ORIENTATION_TOPLEFT);
-        for (uint32 j=0; j<width*height; ++j)
-            buffer[i*width*height+j] = TIFFGetR(slice[j]);
-        TIFFReadDirectory(tif);
-    }
-    delete[] slice;
+
+    // index directory offsets once, slices are decoded concurrently later
+    // count directories by walking the chain, TIFFNumberOfDirectories may be 16 bits
+    std::vector<toff_t> offsets;
+    do offsets.push_back(TIFFCurrentDirOffset(tif)); while (TIFFReadDirectory(tif));
     TIFFClose(tif);
+    size_t depth = offsets.size(), size = (size_t)width*height;
+
+    double t = omp_get_wtime();
+    uint8 *buffer = new uint8[size*depth];
+    int fails = 0;
+    #pragma omp parallel reduction(+:fails)
+    {
+        TIFF *tif = TIFFOpen(path, "rb"); // per thread handle
+        uint32 *slice = 0;
+        #pragma omp for schedule(dynamic)
+        for (int i=0; i<(int)depth; ++i) {
+            if (tif == 0 || !TIFFSetSubDirectory(tif, offsets[i])) {
+                memset(buffer+i*size, 0, size);
+                ++fails;
+                continue;
+            }
+            // assert bits, channels, photometric & width, height
+            if (!ReadSlice(tif, buffer+i*size, width, height)) {
+                if (slice == 0) slice = new uint32[size];
+                TIFFReadRGBAImageOriented(tif, width, height, slice, ORIENTATION_TOPLEFT);
+                for (size_t j=0; j<size; ++j)
+                    buffer[i*size+j] = TIFFGetR(slice[j]);
+            }
+        }
+        if (slice != 0) delete[] slice;
+        if (tif != 0) TIFFClose(tif);
+    }
+    t = omp_get_wtime()-t;
+    if (fails > 0) printf("[Volume::Read] %d of %d slices failed to decode\n", fails, (int)depth);
+    printf("[Volume::Read] decode %d slices ok (%ld ms, %.1f slices/s)\n", (int)depth, (long)(t*1000.0), depth/(t>0.0 ? t : 1e-3));
     printf("[Volume::Read] read TIFF file %s ok\n", path);
 
-    if (_buffer != 0) delete[] _buffer;
+    Release();
     _buffer = buffer;
     _width = width;
     _height = height;
     _depth = depth;
     _thickness = 1.0f;
+    return true;
+}
+
+bool Volume::Read(const char *path)
+{
+    bool ok = IsType(path, ".vol") ? ReadRaw(path) : (IsType(path, ".brk") || IsType(path, ".bkz")) ? ReadBrick(path) : ReadTIFF(path);
+    if (!ok) return false;
+
     _scale = max(max(_width, _height)*1.0f, _depth*_thickness);
     if (_scale < 1.0f) _scale = 1.0f;
 
@@ -88,22 +184,31 @@ bool Volume::Write(const char *path) const
 {
     if (_buffer == 0) return false;
 
-    TIFF *tif = TIFFOpen(path, "wb");
+    if (IsType(path, ".brk")) return Bricks::Write(path, _buffer, _width, _height, _depth, _thickness);
+    if (IsType(path, ".bkz")) return Bricks::Write(path, _buffer, _width, _height, _depth, _thickness, 64, true);
+    return IsType(path, ".vol") ? WriteRaw(path) : WriteTIFF(path);
+}
+
+bool Volume::WriteTIFF(const char *path) const
+{
+    // switch to BigTIFF when the classic 32 bits offsets may not hold the stack
+    size_t size = _width*_height*_depth;
+    TIFF *tif = TIFFOpen(path, (size >= 0xC0000000) ? "wb8" : "wb");
     if (tif == 0) {
         printf("[Volume::Write] open TIFF file %s failed\n", path);
         return false;
     }
 
     for (size_t i=0; i<_depth; ++i) {               
-        TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, _width);
-        TIFFSetField(tif, TIFFTAG_IMAGELENGTH, _height);
-        TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, _height);
+        TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, (uint32)_width);
+        TIFFSetField(tif, TIFFTAG_IMAGELENGTH, (uint32)_height);
+        TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, (uint32)_height);
         TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, 1);
         TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, 8);
         TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK); 
         TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_PACKBITS);
         TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);               
-        TIFFWriteEncodedStrip(tif, 0, _buffer+i*_width*_height, _width*_height);
+        TIFFWriteEncodedStrip(tif, 0, _buffer+i*_width*_height, (tmsize_t)(_width*_height));
         TIFFWriteDirectory(tif);
     }
     TIFFClose(tif);
@@ -111,6 +216,143 @@ bool Volume::Write(const char *path) const
     return true;
 }
 
+// raw volume file: 64 bytes header & row major depth*height*width voxels, mapped without decoding
+struct RawHeader {
+    char Magic[8];
+    unsigned long long Width, Height, Depth;
+    float Thickness;
+    char Reserved[28];
+};
+
+bool Volume::IsType(const char *path, const char *ext)
+{
+    const char *dot = strrchr(path, '.');
+    if (dot == 0 || strlen(dot) != strlen(ext)) return false;
+    for (size_t i=0; ext[i]!=0; ++i)
+        if (tolower(dot[i]) != ext[i]) return false;
+    return true;
+}
+
+bool Volume::ReadRaw(const char *path)
+{
+    unsigned char *map = 0;
+    size_t length = 0;
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, 0);
+    if (file != INVALID_HANDLE_VALUE) {
+        LARGE_INTEGER size;
+        if (GetFileSizeEx(file, &size)) length = (size_t)size.QuadPart;
+        HANDLE mapping = (length > 0) ? CreateFileMappingA(file, 0, PAGE_WRITECOPY, 0, 0, 0) : 0;
+        if (mapping != 0) {
+            map = (unsigned char*)MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+            CloseHandle(mapping);
+        }
+        CloseHandle(file);
+    }
+#else
+    int file = open(path, O_RDONLY);
+    if (file >= 0) {
+        struct stat st;
+        if (fstat(file, &st) == 0) length = (size_t)st.st_size;
+        if (length > 0) {
+            void *ptr = mmap(0, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+            if (ptr != MAP_FAILED) map = (unsigned char*)ptr;
+        }
+        close(file);
+    }
+#endif
+    if (map == 0) {
+        printf("[Volume::Read] open raw volume file %s failed\n", path);
+        return false;
+    }
+
+    RawHeader header;
+    if (length >= sizeof(RawHeader)) memcpy(&header, map, sizeof(RawHeader));
+    if (length < sizeof(RawHeader) || memcmp(header.Magic, "FLNVOL01", 8) != 0
+        || length-sizeof(RawHeader) < header.Width*header.Height*header.Depth) {
+        printf("[Volume::Read] raw volume file %s has an unsupported header\n", path);
+#ifdef _WIN32
+        UnmapViewOfFile(map);
+#else
+        munmap(map, length);
+#endif
+        return false;
+    }
+    printf("[Volume::Read] map raw volume file %s ok\n", path);
+
+    Release();
+    _map = map;
+    _length = length;
+    _buffer = map + sizeof(RawHeader);
+    _width = (size_t)header.Width;
+    _height = (size_t)header.Height;
+    _depth = (size_t)header.Depth;
+    _thickness = (header.Thickness > 0.0f) ? header.Thickness : 1.0f;
+    return true;
+}
+
+bool Volume::WriteRaw(const char *path) const
+{
+    FILE *file = fopen(path, "wb");
+    if (file == 0) {
+        printf("[Volume::Write] open raw volume file %s failed\n", path);
+        return false;
+    }
+
+    RawHeader header;
+    memset(&header, 0, sizeof(RawHeader));
+    memcpy(header.Magic, "FLNVOL01", 8);
+    header.Width = _width;
+    header.Height = _height;
+    header.Depth = _depth;
+    header.Thickness = _thickness;
+    bool ok = fwrite(&header, sizeof(RawHeader), 1, file) == 1;
+    for (size_t i=0; i<_depth && ok; ++i)
+        ok = fwrite(_buffer+i*_width*_height, 1, _width*_height, file) == _width*_height;
+    fclose(file);
+    if (!ok) {
+        printf("[Volume::Write] write raw volume file %s failed\n", path);
+        return false;
+    }
+    printf("[Volume::Write] write raw volume file %s ok\n", path);
+    return true;
+}
+
+bool Volume::ReadBrick(const char *path)
+{
+    // editor keeps the whole tile resident, bricks are only paged through once
+    Bricks bricks;
+    if (!bricks.Open(path, 0)) return false;
+
+    clock_t t = clock();
+    size_t width = bricks.GetWidth(), height = bricks.GetHeight(), depth = bricks.GetDepth();
+    unsigned char *buffer = new unsigned char[width*height*depth];
+    bricks.GetRegion(buffer, 0, 0, 0, width-1, height-1, depth-1);
+    printf("[Volume::Read] read brick volume file %s ok (%ld ms)\n", path, clock()-t);
+
+    Release();
+    _buffer = buffer;
+    _width = width;
+    _height = height;
+    _depth = depth;
+    _thickness = bricks.GetThickness();
+    return true;
+}
+
+void Volume::Release()
+{
+    if (_map != 0) {
+#ifdef _WIN32
+        UnmapViewOfFile(_map);
+#else
+        munmap(_map, _length);
+#endif
+    }
+    else if (_buffer != 0) delete[] _buffer;
+    _buffer = _map = 0;
+    _length = 0;
+}
+
 void Volume::Draw() const
 {
     if (!glIsTexture(_texture)) return;
@@ -27,6 +27,7 @@ public:
     void RemovePoint(int index, int value);
     void BeginUpdate() { Update(); }
     void Update();
+    void Bake();
     void Reset();
     
 private:
@@ -36,6 +37,9 @@ private:
 };
 
 class Probing : public IFilter { // APO
+public:
+    struct Param { float Radius, High, Low, Grads; }; // ray stops, taken per seed when local
+
 public:
     Probing() : _volume(0), _soma(0), _radius(4.0f), _high(127.0f), _low(127.0f), _grads(127.0f), _local(true), _doing(false), _cancel(false) {}
     ~Probing() {}
@@ -44,13 +48,14 @@ public:
     void SetVision(Volume *volume, Soma *soma) { _volume = volume; _soma = soma; }
     void SetParam();
     void SetParam(float radius, float high, float low, float grads) { _radius = radius; _high = high; _low = low; _grads = grads; }
+    Param GetParam() const { Param param = { _radius, _high, _low, _grads }; return param; }
     bool GetLocal() const { return _local; }
     bool SetLocal(bool b) { _local = b; return _local; }
     void AddPoint(const Point &point);
     void BeginUpdate();
     static void UpdateThread(void *data) { ((Probing*)data)->Update(); }
     void Update();
-    void RefinePoint(PCell &point) const;
+    void RefinePoint(PCell &point, const Param &param) const;
     void CancelUpdate() { _cancel = true; }
     bool IsDoing() { return _doing; }
 
@@ -64,7 +69,9 @@ private:
 
 class Tracing : public IFilter { // SWC
 public:
-    Tracing() : _volume(0), _tree(0), _dist(3.0f), _step(2.0f), _radius(16.0f), _high(127.0f), _low(127.0f), _grads(127.0), _local(true), _doing(false), _cancel(false) {}
+    struct Param { float Radius, High, Low, Grads; }; // ray stops, taken per node when local
+
+    Tracing() : _volume(0), _tree(0), _dist(3.0f), _step(2.0f), _radius(16.0f), _high(127.0f), _low(127.0f), _grads(127.0), _local(true), _occupy(true), _doing(false), _cancel(false) {}
     ~Tracing() {}
 
 public:
@@ -74,15 +81,23 @@ public:
     void SetParam(float radius, float high, float low, float grads) { _radius = radius; _high = high; _low = low; _grads = grads; }
     void SetParam(size_t x, size_t y, size_t z, size_t radius);
     void SetParam(PNode &point, float radius) { SetParam((size_t)(point.X+0.5f), (size_t)(point.Y+0.5f), (size_t)(point.Z+0.5f), (size_t)(point.Radius*radius+0.5f)); }
+    Param GetParam() const { Param param = { _radius, _high, _low, _grads }; return param; }
+    Param GetParam(size_t x, size_t y, size_t z, size_t radius) const;
+    Param GetParam(const PNode &point, float radius) const { return GetParam((size_t)(point.X+0.5f), (size_t)(point.Y+0.5f), (size_t)(point.Z+0.5f), (size_t)(point.Radius*radius+0.5f)); }
     bool GetLocal() const { return _local; }
     bool SetLocal(bool b) { _local = b; return _local; }
+    bool GetOccupy() const { return _occupy; }
+    bool SetOccupy(bool b) { _occupy = b; return _occupy; } // skip children landing in traced tubes, checked again in the serial order so the result does not depend on the threads
     void AddSeed(const Point &point);
     void BeginUpdate();
     static void UpdateThread(void *data) { ((Tracing*)data)->Update(); }
     void Update();
-    void Advance(PNode &point, std::vector<PNode> &children) const;
+    void BeginBenchmark();
+    static void BenchmarkThread(void *data) { ((Tracing*)data)->Benchmark(); }
+    void Benchmark(); // replay the last tracing under every voxel layout
+    void Advance(PNode &point, std::vector<PNode> &children, const Param &param) const; // reentrant, tracing threads call it at once
     void GetCenter(unsigned char *image, size_t dimension) const;
-    void RefinePoint(PNode &parent, PNode &point) const;
+    void RefinePoint(PNode &parent, PNode &point, const Param &param) const;
     void CancelUpdate() { _cancel = true; }
     bool IsDoing() { return _doing; }
 
@@ -90,7 +105,7 @@ private:
     Volume *_volume;
     Tree *_tree;
     float _dist, _step, _radius, _high, _low, _grads;
-    bool _local;
-    std::stack<PNode> _seeds;
+    bool _local, _occupy;
+    std::stack<PNode> _seeds, _last; // last seeds are kept for the benchmark
     volatile bool _doing, _cancel;
 };
@@ -36,14 +36,24 @@ void Mapping::Update()
 {
     if (_volume == 0 || _color == 0) return;
 
-    _volume->SetValue(_color->GetValue());
+    // the curve joins the volume mapping, raw voxels stay until baked
+    _volume->SetMapping(_color->GetValue());
     double index[256];
     memset(index, 0, 256*sizeof(double));
     _volume->GetIndex(index);
     _color->SetIndex(index);
     _color->Clear();
     _volume->SetColor(_color->GetValue());
-    printf("[Mapping::Upadte] update volume value and reset color mapping ok\n");
+    printf("[Mapping::Upadte] update volume mapping and reset color mapping ok\n");
+}
+
+void Mapping::Bake()
+{
+    if (_volume == 0 || _color == 0 || !_volume->IsMapped()) return;
+
+    _volume->Bake();
+    _volume->SetColor(_color->GetValue());
+    printf("[Mapping::Bake] bake volume mapping ok\n");
 }
 
 void Mapping::Reset()
@@ -51,5 +61,10 @@ void Mapping::Reset()
     if (_volume == 0 || _color == 0) return;
 
     _color->Clear();
+    _volume->SetMapping(0);
+    double index[256];
+    memset(index, 0, 256*sizeof(double));
+    _volume->GetIndex(index);
+    _color->SetIndex(index);
     _volume->SetColor(_color->GetValue());
 }
@@ -0,0 +1,130 @@
+#include "vision.h"
+
+#include <math.h>
+#include <algorithm>
+
+Occupancy::Occupancy() : _width(0), _height(0), _depth(0), _thickness(1.0f), _nx(0), _ny(0), _nz(0)
+{
+    for (int i=0; i<locks; ++i) omp_init_lock(&_locks[i]);
+}
+
+Occupancy::~Occupancy()
+{
+    Reset(0, 0, 0);
+    for (int i=0; i<locks; ++i) omp_destroy_lock(&_locks[i]);
+}
+
+void Occupancy::Reset(size_t width, size_t height, size_t depth, float thickness)
+{
+    _width = width;
+    _height = height;
+    _depth = depth;
+    _thickness = (thickness > 0.0f) ? thickness : 1.0f;
+    _nx = (width+31)/32;
+    _ny = (height+31)/32;
+    _nz = (depth+31)/32;
+    for (size_t i=0; i<_bricks.size(); ++i) delete[] _bricks[i];
+    _bricks.assign(_nx*_ny*_nz, 0);
+    _tubes.clear();
+    _tubes.resize(_nx*_ny*_nz);
+}
+
+size_t Occupancy::GetResident() const
+{
+    size_t count = 0;
+    for (size_t i=0; i<_bricks.size(); ++i)
+        if (_bricks[i] != 0) ++count;
+    return count;
+}
+
+// voxel x y z within radius of the segment a b, the one test of stamps & ordered lookups
+static bool IsInside(const Point &a, const Point &b, float radius, float thickness, size_t x, size_t y, size_t z)
+{
+    float dx = b.X-a.X, dy = b.Y-a.Y, dz = (b.Z-a.Z)*thickness;
+    float len = dx*dx + dy*dy + dz*dz;
+    float px = x-a.X, py = y-a.Y, pz = (z-a.Z)*thickness;
+    float s = (len > 0.0f) ? std::min(1.0f, std::max(0.0f, (px*dx + py*dy + pz*dz)/len)) : 0.0f;
+    px -= s*dx;
+    py -= s*dy;
+    pz -= s*dz;
+    return px*px + py*py + pz*pz <= radius*radius;
+}
+
+bool Occupancy::IsOccupied(float x, float y, float z) const
+{
+    if (x < 0.0f || y < 0.0f || z < 0.0f) return false;
+    size_t ix = (size_t)(x+0.5f), iy = (size_t)(y+0.5f), iz = (size_t)(z+0.5f);
+    if (ix >= _width || iy >= _height || iz >= _depth) return false;
+
+    // brick pointers & words are published by other threads, loads are atomic as the stores
+    size_t bit = ((iz&31)*32 + (iy&31))*32 + (ix&31);
+    const unsigned int *brick;
+    #pragma omp atomic read
+    brick = _bricks[((iz>>5)*_ny + (iy>>5))*_nx + (ix>>5)];
+    if (brick == 0) return false;
+    unsigned int word;
+    #pragma omp atomic read
+    word = brick[bit>>5];
+    return (word & (1u << (bit&31))) != 0;
+}
+
+bool Occupancy::IsOccupied(float x, float y, float z, unsigned long long order, unsigned depth) const
+{
+    // the bits answer most lookups, a set bit is checked against the tubes of its brick
+    if (!IsOccupied(x, y, z)) return false;
+    size_t ix = (size_t)(x+0.5f), iy = (size_t)(y+0.5f), iz = (size_t)(z+0.5f);
+    size_t id = ((iz>>5)*_ny + (iy>>5))*_nx + (ix>>5);
+    bool hit = false;
+    omp_set_lock(&_locks[id%locks]);
+    const std::vector<Tube> &tubes = _tubes[id];
+    for (size_t i=0; i<tubes.size() && !hit; ++i) {
+        const Tube &tube = tubes[i];
+        if (tube.Order > order || (tube.Order == order && tube.Depth >= depth)) continue;
+        hit = IsInside(tube.A, tube.B, tube.Radius, _thickness, ix, iy, iz);
+    }
+    omp_unset_lock(&_locks[id%locks]);
+    return hit;
+}
+
+void Occupancy::Stamp(const Point &a, const Point &b, float radius, unsigned long long order, unsigned depth)
+{
+    if (_bricks.empty() || radius <= 0.0f) return;
+
+    // bounding box of the capsule, z in slices
+    float rz = radius/_thickness;
+    float x0 = std::max(0.0f, floorf(std::min(a.X, b.X)-radius)), x1 = std::min((float)_width-1.0f, ceilf(std::max(a.X, b.X)+radius));
+    float y0 = std::max(0.0f, floorf(std::min(a.Y, b.Y)-radius)), y1 = std::min((float)_height-1.0f, ceilf(std::max(a.Y, b.Y)+radius));
+    float z0 = std::max(0.0f, floorf(std::min(a.Z, b.Z)-rz)), z1 = std::min((float)_depth-1.0f, ceilf(std::max(a.Z, b.Z)+rz));
+    if (x0 > x1 || y0 > y1 || z0 > z1) return;
+
+    // the tube is listed in every brick of its box before its bits are set, an ordered lookup hitting a bit finds it
+    Tube tube = { a, b, radius, order, depth };
+    for (size_t bz=(size_t)z0>>5; bz<=((size_t)z1>>5); ++bz) {
+        for (size_t by=(size_t)y0>>5; by<=((size_t)y1>>5); ++by) {
+            for (size_t bx=(size_t)x0>>5; bx<=((size_t)x1>>5); ++bx) {
+                size_t id = (bz*_ny + by)*_nx + bx;
+                omp_set_lock(&_locks[id%locks]);
+                _tubes[id].push_back(tube);
+                if (_bricks[id] == 0) {
+                    unsigned int *words = new unsigned int[1024]();
+                    #pragma omp flush
+                    #pragma omp atomic write
+                    _bricks[id] = words;
+                }
+                omp_unset_lock(&_locks[id%locks]);
+            }
+        }
+    }
+
+    for (size_t z=(size_t)z0; z<=(size_t)z1; ++z) {
+        for (size_t y=(size_t)y0; y<=(size_t)y1; ++y) {
+            for (size_t x=(size_t)x0; x<=(size_t)x1; ++x) {
+                if (!IsInside(a, b, radius, _thickness, x, y, z)) continue;
+                unsigned int *brick = _bricks[((z>>5)*_ny + (y>>5))*_nx + (x>>5)]; // allocated in the loop above
+                size_t bit = ((z&31)*32 + (y&31))*32 + (x&31);
+                #pragma omp atomic
+                brick[bit>>5] |= 1u << (bit&31);
+            }
+        }
+    }
+}
@@ -0,0 +1,200 @@
+#include "vision.h"
+
+#include <math.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <algorithm>
+
+// 1D line filters, lines are clamped to their edge voxels
+struct GaussianLine {
+    std::vector<float> W;
+    int R;
+    GaussianLine(float sigma) : R((int)ceil(3.0f*sigma)) {
+        W.resize(2*R+1);
+        float sum = 0.0f;
+        for (int k=-R; k<=R; ++k) sum += W[k+R] = expf(-0.5f*k*k/(sigma*sigma));
+        for (int k=0; k<=2*R; ++k) W[k] /= sum;
+    }
+    void operator()(const unsigned char *in, unsigned char *out, size_t n) const {
+        for (size_t i=0; i<n; ++i) {
+            float sum = 0.0f;
+            for (int k=-R; k<=R; ++k) {
+                ptrdiff_t j = (ptrdiff_t)i+k;
+                sum += W[k+R]*in[(j < 0) ? 0 : (j >= (ptrdiff_t)n) ? n-1 : j];
+            }
+            out[i] = (unsigned char)(sum+0.5f);
+        }
+    }
+};
+
+struct MedianLine {
+    int R;
+    MedianLine(int radius) : R(std::min(radius, 31)) {}
+    void operator()(const unsigned char *in, unsigned char *out, size_t n) const {
+        unsigned char window[63];
+        for (size_t i=0; i<n; ++i) {
+            for (int k=-R; k<=R; ++k) {
+                ptrdiff_t j = (ptrdiff_t)i+k;
+                window[k+R] = in[(j < 0) ? 0 : (j >= (ptrdiff_t)n) ? n-1 : j];
+            }
+            std::nth_element(window, window+R, window+2*R+1);
+            out[i] = window[R];
+        }
+    }
+};
+
+// van Herk / Gil-Werman running minimum or maximum, 3 compares per voxel whatever the radius
+template <bool Max>
+struct ExtremeLine {
+    size_t R;
+    ExtremeLine(size_t radius) : R(radius) {}
+    static unsigned char Pick(unsigned char a, unsigned char b) { return Max ? std::max(a, b) : std::min(a, b); }
+    void operator()(const unsigned char *in, unsigned char *out, size_t n) const {
+        size_t w = 2*R+1, m = n+2*R;
+        std::vector<unsigned char> p(m), g(m), h(m);
+        for (size_t i=0; i<m; ++i) p[i] = in[(i < R) ? 0 : (i-R >= n) ? n-1 : i-R];
+        for (size_t i=0; i<m; ++i) g[i] = (i%w == 0) ? p[i] : Pick(g[i-1], p[i]);
+        for (size_t i=m; i-- > 0;) h[i] = (i%w == w-1 || i == m-1) ? p[i] : Pick(h[i+1], p[i]);
+        for (size_t i=0; i<n; ++i) out[i] = Pick(h[i], g[i+w-1]);
+    }
+};
+
+// one 1D filter along an axis of the whole volume, x rows in place,
+// y & z lines gathered 64 columns at a time so reads & writes stay on whole cache lines
+template <class Line>
+static void Pass(unsigned char *buffer, size_t width, size_t height, size_t depth, int axis, const Line &line)
+{
+    static const size_t tile = 64;
+    if (axis == 0) {
+        #pragma omp parallel
+        {
+            std::vector<unsigned char> in(width);
+            #pragma omp for schedule(dynamic, 16)
+            for (int r=0; r<(int)(height*depth); ++r) {
+                unsigned char *row = buffer + r*width;
+                memcpy(&in[0], row, width);
+                line(&in[0], row, width);
+            }
+        }
+        return;
+    }
+
+    size_t n = (axis == 1) ? height : depth;
+    size_t stride = (axis == 1) ? width : width*height;
+    size_t outer = (axis == 1) ? depth : height, base = (axis == 1) ? width*height : width;
+    size_t tiles = (width+tile-1)/tile;
+    #pragma omp parallel
+    {
+        std::vector<unsigned char> block(n*tile), in(n), out(n);
+        #pragma omp for schedule(dynamic)
+        for (int o=0; o<(int)(outer*tiles); ++o) {
+            size_t x0 = (o%tiles)*tile, w = std::min(tile, width-x0);
+            unsigned char *start = buffer + (o/tiles)*base + x0;
+            for (size_t i=0; i<n; ++i) memcpy(&block[i*tile], start+i*stride, w);
+            for (size_t c=0; c<w; ++c) {
+                for (size_t i=0; i<n; ++i) in[i] = block[i*tile+c];
+                line(&in[0], &out[0], n);
+                for (size_t i=0; i<n; ++i) block[i*tile+c] = out[i];
+            }
+            for (size_t i=0; i<n; ++i) memcpy(start+i*stride, &block[i*tile], w);
+        }
+    }
+}
+
+// z sizes are in slices, thicker slices need fewer of them
+static float GetSizeZ(float size, float thickness)
+{
+    return (thickness > 0.0f) ? size/thickness : size;
+}
+
+void Preprocess::Gaussian(unsigned char *buffer, size_t width, size_t height, size_t depth, float sigma, float thickness)
+{
+    if (buffer == 0 || sigma <= 0.0f) return;
+
+    GaussianLine line(sigma);
+    Pass(buffer, width, height, depth, 0, line);
+    Pass(buffer, width, height, depth, 1, line);
+    float sz = GetSizeZ(sigma, thickness);
+    if (sz >= 0.1f) Pass(buffer, width, height, depth, 2, GaussianLine(sz));
+}
+
+void Preprocess::Median(unsigned char *buffer, size_t width, size_t height, size_t depth, float radius, float thickness)
+{
+    // median of medians along x, y & z, close to the cube median at a fraction of its cost
+    int r = (int)(radius+0.5f), rz = (int)(GetSizeZ(radius, thickness)+0.5f);
+    if (buffer == 0 || r <= 0) return;
+
+    MedianLine line(r);
+    Pass(buffer, width, height, depth, 0, line);
+    Pass(buffer, width, height, depth, 1, line);
+    if (rz > 0) Pass(buffer, width, height, depth, 2, MedianLine(rz));
+}
+
+void Preprocess::TopHat(unsigned char *buffer, size_t width, size_t height, size_t depth, float radius, float thickness)
+{
+    // background is the opening by a cuboid, erosion then dilation, both separable
+    size_t r = (size_t)(radius+0.5f), rz = (size_t)(GetSizeZ(radius, thickness)+0.5f);
+    if (buffer == 0 || r == 0) return;
+
+    size_t size = width*height*depth;
+    std::vector<unsigned char> background(buffer, buffer+size);
+    unsigned char *b = &background[0];
+    Pass(b, width, height, depth, 0, ExtremeLine<false>(r));
+    Pass(b, width, height, depth, 1, ExtremeLine<false>(r));
+    if (rz > 0) Pass(b, width, height, depth, 2, ExtremeLine<false>(rz));
+    Pass(b, width, height, depth, 0, ExtremeLine<true>(r));
+    Pass(b, width, height, depth, 1, ExtremeLine<true>(r));
+    if (rz > 0) Pass(b, width, height, depth, 2, ExtremeLine<true>(rz));
+
+    #pragma omp parallel for
+    for (int z=0; z<(int)depth; ++z) {
+        unsigned char *p = buffer + z*width*height;
+        const unsigned char *q = b + z*width*height;
+        for (size_t i=0; i<width*height; ++i) p[i] = (unsigned char)(p[i]-q[i]); // opening never exceeds the voxel
+    }
+}
+
+bool Preprocess::SetChain(const char *text)
+{
+    // steps like "g1.5 m1 t12", Gaussian sigma, median radius & top-hat radius in x y voxels
+    std::vector<Step> steps;
+    while (text != 0 && *text != 0) {
+        if (*text == ' ' || *text == ',' || *text == '\t') {
+            ++text;
+            continue;
+        }
+        Step step;
+        switch (*text) {
+        case 'g': case 'G': step.Type = PRE_GAUSSIAN; break;
+        case 'm': case 'M': step.Type = PRE_MEDIAN; break;
+        case 't': case 'T': step.Type = PRE_TOPHAT; break;
+        default: return false;
+        }
+        char *end = 0;
+        step.Size = (float)strtod(text+1, &end);
+        if (end == text+1 || step.Size <= 0.0f) return false;
+        steps.push_back(step);
+        text = end;
+    }
+    _steps = steps;
+    return true;
+}
+
+void Preprocess::Run(const unsigned char *src, unsigned char *dst, size_t width, size_t height, size_t depth, float thickness) const
+{
+    static const char *names[] = { "Gaussian", "median", "top-hat" };
+    if (src == 0 || dst == 0) return;
+
+    if (dst != src) memcpy(dst, src, width*height*depth);
+    for (size_t i=0; i<_steps.size(); ++i) {
+        double t = omp_get_wtime();
+        const Step &step = _steps[i];
+        if (step.Type == PRE_GAUSSIAN) Gaussian(dst, width, height, depth, step.Size, thickness);
+        else if (step.Type == PRE_MEDIAN) Median(dst, width, height, depth, step.Size, thickness);
+        else if (step.Type == PRE_TOPHAT) TopHat(dst, width, height, depth, step.Size, thickness);
+        t = omp_get_wtime()-t;
+        printf("[Preprocess::Run] %s filter of size %.2f ok (%ld ms)\n", names[step.Type], step.Size, (long)(t*1000.0));
+    }
+}
@@ -12,6 +12,7 @@ void Probing::SetParam()
     if (_volume == 0 || _soma == 0) return;
 
     _soma->SetExtent(_volume->GetWidth(), _volume->GetHeight(), _volume->GetDepth(), _volume->GetThickness());
+    _soma->SetOffset(_volume->GetOffsetX(), _volume->GetOffsetY(), _volume->GetOffsetZ());
 
     float mean, low, high;
     _volume->GetValue(mean, low, high);
@@ -29,15 +30,24 @@ void Probing::AddPoint(const Point &seed)
     point.Value = _volume->GetVoxel(point);
     if (point.Value < _low) return;
 
+    // local thresholds of the seed from the volume threshold field
+    Param param = GetParam();
+    float mean, low, high;
+    if (_local && _volume->GetLocalValue(mean, low, high, point.X, point.Y, point.Z)) {
+        param.High = (mean+high)/2.0f;
+        param.Low = (low+mean+high)/3.0f;
+        param.Grads = 255.0f-param.Low;
+    }
+
     size_t len = _soma->GetSize();
-    RefinePoint(point);
+    RefinePoint(point, param);
     _soma->AddPoint(point);
     _soma->Reduce(len);
 }
 
 void Probing::BeginUpdate()
 {
-    if (_volume == 0 || _soma == 0 || _doing) return;
+    if (_volume == 0 || _soma == 0 || _doing || _volume->IsLoading()) return;
 
     _beginthread(Probing::UpdateThread, 0, (void*)this);
     _cancel = false;
@@ -46,25 +56,22 @@ void Probing::BeginUpdate()
 void Probing::Update()
 {
     if (_volume == 0 || _soma == 0 || _doing) return;
+    if (_volume->IsBricked()) {
+        printf("[Probing::Update] probing out-of-core volume is unsupported\n");
+        return;
+    }
 
     static const float rs = 0.61803399f;
 
     _doing = true;
-    float params[4];
-    if (_local) {
-        params[0] = _radius;
-        params[1] = _high;
-        params[2] = _low;
-        params[3] = _grads;
-    }
-
+    Param param = GetParam();
     size_t len = _soma->GetSize();
     printf("[Probing::Update] probing starting, there are %d cells in soma model\n", len);
     if (_local && len > 0) {
-        _radius = _soma->GetPoint(0).Radius;
+        param.Radius = _soma->GetPoint(0).Radius;
         for (size_t i=1; i<len; ++i) {
             float radius = _soma->GetPoint(i).Radius;
-            if (radius < _radius) _radius = radius;
+            if (radius < param.Radius) param.Radius = radius;
         }
     }
     if (_cancel) {
@@ -86,7 +93,7 @@ void Probing::Update()
             for (size_t x=1; x<width-1; ++x) {
                 id = z*width*height + y*width + x;
                 v = _volume->GetVoxel(x, y, z);
-                if (v >= _high) volume[id] = v;
+                if (v >= param.High) volume[id] = v;
                 else volume[id] = 0;
             }
         }
@@ -215,8 +222,11 @@ void Probing::Update()
                     point.Value = _volume->GetVoxel(point);
                     point.Radius = 0.0f;
                     point.Minor = 0.0f;
-                    RefinePoint(point);
-                    if (point.Radius >= rs*_radius) _soma->AddPoint(point);
+                    RefinePoint(point, param);
+                    if (point.Radius >= rs*param.Radius) {
+                        #pragma omp critical
+                        _soma->AddPoint(point);
+                    }
                 }
             }
         }
@@ -225,57 +235,57 @@ void Probing::Update()
     printf("[Probing::Update] probing finished, there are %d cells in soma model (%ld ms)\n", _soma->GetSize(), clock()-t);
 
     t = clock();
-    _soma->Reduce();
+    _soma->Reduce(0, true);
     printf("[Probing::Update] simplify soma model to %d cells (%ld ms)\n", _soma->GetSize(), clock()-t);
 
-    if (_local) {
-        _radius = params[0];
-        _high = params[1];
-        _low = params[2];
-        _grads = params[3];
-    }
     _doing = false;
 }
 
-void Probing::RefinePoint(PCell &point) const
-{
-    static const int udim = 9, vdim = 8, dim = 130;
-    static const float pi = 3.14159265f;
-    static const float bias = 2.0f; // 1.41421356f 1.73205081f 2.23606798f
-
-    static glm::vec3 dirs[dim];
-    static float thickness = 0.0f;
-    if (thickness != _volume->GetThickness()) {
-        thickness = _volume->GetThickness();
+// rays of RefinePoint, udim/2 rings of vdim*i directions of a hemisphere around z & their opposites
+// built at startup, so probing threads only ever read them, z is scaled by the thickness where used
+struct Sphere {
+    enum { udim = 9, vdim = 8, dim = 130 };
+    glm::vec3 Dirs[dim];
+    Sphere() {
+        static const float pi = 3.14159265f;
         int vth = 1, ith = 0;
         for (int i=0; i<=udim/2; ++i) {
             vth = glm::max(i*vdim, 1);
             for (int j=0; j<vth; ++j) {
-                dirs[ith].x = glm::sin(i*pi/(udim-1))*glm::cos(j*2.0f*pi/vth);
-                dirs[ith].y = glm::sin(i*pi/(udim-1))*glm::sin(j*2.0f*pi/vth);
-                dirs[ith].z = glm::cos(i*pi/(udim-1))/thickness;
-                //dirs[ith] = glm::normalize(dirs[ith]);
-                dirs[dim/2+ith] = -1.0f*dirs[ith];
+                Dirs[ith].x = glm::sin(i*pi/(udim-1))*glm::cos(j*2.0f*pi/vth);
+                Dirs[ith].y = glm::sin(i*pi/(udim-1))*glm::sin(j*2.0f*pi/vth);
+                Dirs[ith].z = glm::cos(i*pi/(udim-1));
+                Dirs[dim/2+ith] = -1.0f*Dirs[ith];
                 ++ith;
                 if (ith >= dim/2) break;
             }
         }
-    }    
+    }
+};
+
+static const Sphere sphere;
+
+void Probing::RefinePoint(PCell &point, const Param &param) const
+{
+    static const int dim = Sphere::dim;
+    static const float bias = 2.0f; // 1.41421356f 1.73205081f 2.23606798f
 
-    static PCell point0, point1, points[dim];
+    // scratch state is per call, the probing threads refine points at once
+    float thickness = _volume->GetThickness();
+    PCell point0, point1, points[dim];
+    Rays rays;
+    for (int i=0; i<dim; ++i) rays.AddRay(sphere.Dirs[i].x, sphere.Dirs[i].y, sphere.Dirs[i].z/thickness);
     do {    
+        rays.SetOrigin(point.X, point.Y, point.Z, point.Value);
+        rays.SetStop(param.Low, 256.0f, param.Grads, FLT_MAX);
+        rays.Cast(_volume->GetSampler(), 0.0f, 0.5f);
         for (int i=0; i<dim; ++i) {
-            point1 = point;
-            point1.Radius = 0.0f;
-            do {
-                point0 = point1;
-                point1.Radius += 0.5f;
-                point1.X = point.X + dirs[i].x*point1.Radius;
-                point1.Y = point.Y + dirs[i].y*point1.Radius;
-                point1.Z = point.Z + dirs[i].z*point1.Radius;
-                point1.Value = _volume->GetVoxel(point1);
-            } while (point1.Value >= _low && abs(point1.Value-point.Value) <= _grads);
-            points[i] = point0;
+            points[i] = point;
+            points[i].X = rays.GetX(i);
+            points[i].Y = rays.GetY(i);
+            points[i].Z = rays.GetZ(i);
+            points[i].Value = rays.GetValue(i);
+            points[i].Radius = rays.GetRadius(i);
         }
 
         point0 = point;
@@ -0,0 +1,53 @@
+#include "vision.h"
+
+#include <math.h>
+
+void Rays::Cast(const Sampler &sampler, float radius, float step)
+{
+    size_t n = _i.size();
+    _x.assign(n, _x0);
+    _y.assign(n, _y0);
+    _z.assign(n, _z0);
+    _value.assign(n, _value0);
+    _radius.assign(n, radius);
+    _xyz.resize(3*n);
+    _sample.resize(n);
+    _pass.resize(n);
+    _live.resize(n);
+    for (size_t i=0; i<n; ++i) _live[i] = i;
+
+    // every live ray sits on the same radius, so one step is one batched lookup of the packed lanes
+    size_t count = n;
+    while (count > 0) {
+        radius += step;
+        if (!(radius <= _limit)) break;
+
+        for (size_t l=0; l<count; ++l) {
+            size_t i = _live[l];
+            _xyz[3*l] = _x0 + _i[i]*radius;
+            _xyz[3*l+1] = _y0 + _j[i]*radius;
+            _xyz[3*l+2] = _z0 + _k[i]*radius;
+        }
+        sampler.GetVoxels(&_xyz[0], &_sample[0], count);
+
+        // termination mask, branch free so it vectorizes
+        for (size_t l=0; l<count; ++l) {
+            float v = _sample[l];
+            _pass[l] = (unsigned char)((v >= _high) | ((v >= _low) & (fabsf(v-_value0) <= _grads)));
+        }
+
+        // stopped lanes drop out, survivors keep their order
+        size_t live = 0;
+        for (size_t l=0; l<count; ++l) {
+            if (!_pass[l]) continue;
+            size_t i = _live[l];
+            _x[i] = _xyz[3*l];
+            _y[i] = _xyz[3*l+1];
+            _z[i] = _xyz[3*l+2];
+            _value[i] = _sample[l];
+            _radius[i] = radius;
+            _live[live++] = i;
+        }
+        count = live;
+    }
+}
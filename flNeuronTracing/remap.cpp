@@ -0,0 +1,239 @@
+#include "vision.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <algorithm>
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <intrin.h>
+#include <immintrin.h>
+#define REMAP_X86
+#define TARGET_SSE41
+#define TARGET_AVX2
+#elif defined(__i386__) || defined(__x86_64__)
+#include <immintrin.h>
+#define REMAP_X86
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+static const char *names[] = { "scalar", "SSE4.1", "AVX2" };
+
+// CPU features, AVX2 also needs the OS to save ymm registers
+static int Detect()
+{
+#if defined(REMAP_X86) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    int top = info[0];
+    __cpuid(info, 1);
+    bool sse41 = (info[2] & (1<<19)) != 0;
+    bool avx = (info[2] & (1<<27)) != 0 && (info[2] & (1<<28)) != 0 && (_xgetbv(0) & 6) == 6;
+    bool avx2 = false;
+    if (top >= 7) {
+        __cpuidex(info, 7, 0);
+        avx2 = avx && (info[1] & (1<<5)) != 0;
+    }
+    return avx2 ? REMAP_AVX2 : sse41 ? REMAP_SSE41 : REMAP_SCALAR;
+#elif defined(REMAP_X86)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? REMAP_AVX2 : __builtin_cpu_supports("sse4.1") ? REMAP_SSE41 : REMAP_SCALAR;
+#else
+    return REMAP_SCALAR;
+#endif
+}
+
+// picked once at startup, before any remap thread runs
+static int detected = Detect(), level = detected;
+
+int Remap::GetLevel()
+{
+    return level;
+}
+
+int Remap::SetLevel(int l)
+{
+    level = (l < REMAP_SCALAR) ? REMAP_SCALAR : (l > detected) ? detected : l;
+    return level;
+}
+
+const char *Remap::GetName()
+{
+    return names[GetLevel()];
+}
+
+// clamped to [low,high] then scaled to [0,255] by x*m>>16, m = ceil(255*2^16/(high-low)) is exact for 8 bits
+static unsigned GetScale(int &low, int &high)
+{
+    if (low < 0) low = 0;
+    if (low > 255) low = 255;
+    if (high > 255) high = 255;
+    if (high < low) high = low;
+    unsigned d = (high > low) ? (unsigned)(high-low) : 1;
+    return (255u*65536u + d - 1)/d;
+}
+
+static void LutScalar(unsigned char *row, size_t n, size_t rows, size_t stride, const unsigned char *lut)
+{
+    for (size_t j=0; j<rows; ++j, row+=stride)
+        for (size_t i=0; i<n; ++i) row[i] = lut[row[i]];
+}
+
+static void WindowScalar(unsigned char *row, size_t n, size_t rows, size_t stride, int low, int high, unsigned m)
+{
+    for (size_t j=0; j<rows; ++j, row+=stride) {
+        for (size_t i=0; i<n; ++i) {
+            unsigned v = row[i];
+            v = (v > (unsigned)low) ? v : (unsigned)low;
+            v = (v < (unsigned)high) ? v : (unsigned)high;
+            row[i] = (unsigned char)(((v-low)*m) >> 16);
+        }
+    }
+}
+
+#if defined(REMAP_X86)
+// 256 entries as 16 pshufb tables, v-16t+0x70 saturated keeps bit 7 clear only for the table of the high nibble
+// 16 lanes do not pay for the 16 shuffles, so SSE4.1 keeps the scalar LUT
+TARGET_AVX2 static void LutAVX2(unsigned char *row, size_t n, size_t rows, size_t stride, const unsigned char *lut)
+{
+    __m256i table[16];
+    for (int t=0; t<16; ++t) table[t] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(lut+16*t)));
+    const __m256i bias = _mm256_set1_epi8(0x70), step = _mm256_set1_epi8(16);
+    for (size_t j=0; j<rows; ++j, row+=stride) {
+        size_t i = 0;
+        // 2 vectors at once, their chains of 16 steps interleave
+        for (; i+64<=n; i+=64) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(row+i)), w = _mm256_loadu_si256((const __m256i*)(row+i+32));
+            __m256i r = _mm256_shuffle_epi8(table[0], _mm256_adds_epu8(v, bias)), s = _mm256_shuffle_epi8(table[0], _mm256_adds_epu8(w, bias));
+            for (int t=1; t<16; ++t) {
+                v = _mm256_sub_epi8(v, step);
+                w = _mm256_sub_epi8(w, step);
+                r = _mm256_or_si256(r, _mm256_shuffle_epi8(table[t], _mm256_adds_epu8(v, bias)));
+                s = _mm256_or_si256(s, _mm256_shuffle_epi8(table[t], _mm256_adds_epu8(w, bias)));
+            }
+            _mm256_storeu_si256((__m256i*)(row+i), r);
+            _mm256_storeu_si256((__m256i*)(row+i+32), s);
+        }
+        for (; i+32<=n; i+=32) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(row+i));
+            __m256i r = _mm256_shuffle_epi8(table[0], _mm256_adds_epu8(v, bias));
+            for (int t=1; t<16; ++t) {
+                v = _mm256_sub_epi8(v, step);
+                r = _mm256_or_si256(r, _mm256_shuffle_epi8(table[t], _mm256_adds_epu8(v, bias)));
+            }
+            _mm256_storeu_si256((__m256i*)(row+i), r);
+        }
+        for (; i<n; ++i) row[i] = lut[row[i]];
+    }
+}
+
+// clamp on bytes, the product on 32 bits lanes, packed back with saturation
+TARGET_SSE41 static void WindowSSE41(unsigned char *row, size_t n, size_t rows, size_t stride, int low, int high, unsigned m)
+{
+    const __m128i lo = _mm_set1_epi8((char)low), hi = _mm_set1_epi8((char)high), mul = _mm_set1_epi32((int)m);
+    for (size_t j=0; j<rows; ++j, row+=stride) {
+        size_t i = 0;
+        for (; i+16<=n; i+=16) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(row+i));
+            v = _mm_sub_epi8(_mm_min_epu8(_mm_max_epu8(v, lo), hi), lo);
+            __m128i p0 = _mm_srli_epi32(_mm_mullo_epi32(_mm_cvtepu8_epi32(v), mul), 16);
+            __m128i p1 = _mm_srli_epi32(_mm_mullo_epi32(_mm_cvtepu8_epi32(_mm_srli_si128(v, 4)), mul), 16);
+            __m128i p2 = _mm_srli_epi32(_mm_mullo_epi32(_mm_cvtepu8_epi32(_mm_srli_si128(v, 8)), mul), 16);
+            __m128i p3 = _mm_srli_epi32(_mm_mullo_epi32(_mm_cvtepu8_epi32(_mm_srli_si128(v, 12)), mul), 16);
+            _mm_storeu_si128((__m128i*)(row+i), _mm_packus_epi16(_mm_packus_epi32(p0, p1), _mm_packus_epi32(p2, p3)));
+        }
+        WindowScalar(row+i, n-i, 1, 0, low, high, m);
+    }
+}
+
+TARGET_AVX2 static void WindowAVX2(unsigned char *row, size_t n, size_t rows, size_t stride, int low, int high, unsigned m)
+{
+    const __m256i lo = _mm256_set1_epi8((char)low), hi = _mm256_set1_epi8((char)high), mul = _mm256_set1_epi32((int)m);
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    for (size_t j=0; j<rows; ++j, row+=stride) {
+        size_t i = 0;
+        for (; i+32<=n; i+=32) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(row+i));
+            v = _mm256_sub_epi8(_mm256_min_epu8(_mm256_max_epu8(v, lo), hi), lo);
+            __m128i a = _mm256_castsi256_si128(v), b = _mm256_extracti128_si256(v, 1);
+            __m256i p0 = _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_cvtepu8_epi32(a), mul), 16);
+            __m256i p1 = _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_cvtepu8_epi32(_mm_srli_si128(a, 8)), mul), 16);
+            __m256i p2 = _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_cvtepu8_epi32(b), mul), 16);
+            __m256i p3 = _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_cvtepu8_epi32(_mm_srli_si128(b, 8)), mul), 16);
+            // packs work per 128 bits lane, dwords of 4 voxels come out as 0 2 4 6 1 3 5 7
+            __m256i r = _mm256_packus_epi16(_mm256_packus_epi32(p0, p1), _mm256_packus_epi32(p2, p3));
+            _mm256_storeu_si256((__m256i*)(row+i), _mm256_permutevar8x32_epi32(r, order));
+        }
+        WindowScalar(row+i, n-i, 1, 0, low, high, m);
+    }
+}
+#endif
+
+void Remap::Lut(unsigned char *row, size_t n, size_t rows, size_t stride, const unsigned char *lut)
+{
+    if (row == 0 || lut == 0) return;
+#if defined(REMAP_X86)
+    if (GetLevel() == REMAP_AVX2) {
+        LutAVX2(row, n, rows, stride, lut);
+        return;
+    }
+#endif
+    LutScalar(row, n, rows, stride, lut);
+}
+
+void Remap::Window(unsigned char *row, size_t n, size_t rows, size_t stride, int low, int high)
+{
+    if (row == 0) return;
+    unsigned m = GetScale(low, high);
+#if defined(REMAP_X86)
+    switch (GetLevel()) {
+    case REMAP_AVX2: WindowAVX2(row, n, rows, stride, low, high, m); return;
+    case REMAP_SSE41: WindowSSE41(row, n, rows, stride, low, high, m); return;
+    }
+#endif
+    WindowScalar(row, n, rows, stride, low, high, m);
+}
+
+void Remap::Benchmark(size_t size)
+{
+    // rows of a 1024 wide volume, split over threads as volume remaps are
+    const size_t width = 1024;
+    size_t rows = (size+width-1)/width;
+    std::vector<unsigned char> buffer(rows*width);
+    for (size_t i=0; i<buffer.size(); ++i) buffer[i] = (unsigned char)(rand() >> 4);
+    unsigned char lut[256];
+    for (int v=0; v<256; ++v) lut[v] = (unsigned char)(255-v);
+    unsigned char *data = &buffer[0];
+    double gb = buffer.size()/1e9;
+    const int low = 20, high = 220;
+    const float diff = 255.0f/(high-low);
+
+    // level -1 is the per voxel loops, a table lookup & a float clamp and scale, then every kernel this CPU runs, best of 3 runs
+    int current = GetLevel();
+    for (int l=-1; l<=detected; ++l) {
+        if (l >= 0) SetLevel(l);
+        for (int op=0; op<2; ++op) {
+            double best = 0.0;
+            for (int k=0; k<3; ++k) {
+                double t = omp_get_wtime();
+                #pragma omp parallel for
+                for (int j=0; j<(int)rows; j+=64) {
+                    unsigned char *row = data + j*width;
+                    size_t count = std::min((size_t)64, rows-j);
+                    if (l >= 0 && op == 0) Lut(row, width, count, width, lut);
+                    else if (l >= 0) Window(row, width, count, width, low, high);
+                    else if (op == 0) {
+                        for (size_t i=0; i<count*width; ++i) row[i] = lut[row[i]];
+                    }
+                    else {
+                        for (size_t i=0; i<count*width; ++i) row[i] = (unsigned char)((((row[i] < low) ? low : (row[i] > high) ? high : row[i])-low)*diff);
+                    }
+                }
+                double s = omp_get_wtime()-t; // wall time, clock() sums the threads
+                if (k == 0 || s < best) best = s;
+            }
+            printf("[Remap::Benchmark] %s %s %.2f GB/s\n", (l < 0) ? "per voxel" : names[l], (op == 0) ? "LUT" : "window", gb/((best > 0.0) ? best : 1e-9));
+        }
+    }
+    SetLevel(current);
+}
@@ -0,0 +1,329 @@
+#include "vision.h"
+
+#include <math.h>
+#include <string.h>
+#include <time.h>
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <immintrin.h>
+#define SAMPLER_X86
+#define TARGET_AVX2
+#elif defined(__i386__) || defined(__x86_64__)
+#include <immintrin.h>
+#define SAMPLER_X86
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+void Sampler::Reset(const Volume *volume, const unsigned char *buffer, size_t width, size_t height, size_t depth, int layout)
+{
+    _volume = volume;
+    _buffer = buffer;
+    _width = width;
+    _height = height;
+    _depth = depth;
+    _sy = width;
+    _sz = width*height;
+    _size = width*height*depth;
+    _xmax = (width > 1) ? (float)(width-1) : 0.0f;
+    _ymax = (height > 1) ? (float)(height-1) : 0.0f;
+    _zmax = (depth > 1) ? (float)(depth-1) : 0.0f;
+
+    _layout = (buffer != 0) ? layout : VOX_LINEAR;
+    _bsy = ((width+7)/8)*512;
+    _bsz = ((height+7)/8)*_bsy;
+    std::vector<unsigned char>().swap(_bricks);
+    if (_layout != VOX_BRICK) return;
+
+    // 4 spare bytes for 32 bits gathers of the last voxel
+    clock_t t = clock();
+    _bricks.assign(((depth+7)/8)*_bsz + 4, 0);
+    Update(0, 0, 0, width-1, height-1, depth-1);
+    printf("[Sampler::Reset] build 8^3 bricks voxel layout ok (%ld ms)\n", clock()-t);
+}
+
+void Sampler::Update(size_t x0, size_t y0, size_t z0, size_t x1, size_t y1, size_t z1)
+{
+    if (_layout != VOX_BRICK || _buffer == 0 || x0 > x1 || y0 > y1 || z0 > z1 || x1 >= _width || y1 >= _height || z1 >= _depth) return;
+
+    #pragma omp parallel for
+    for (int z=(int)z0; z<=(int)z1; ++z) {
+        for (size_t y=y0; y<=y1; ++y) {
+            const unsigned char *src = _buffer + z*_sz + y*_sy;
+            unsigned char *dst = &_bricks[0] + GetOffsetY(y) + GetOffsetZ(z);
+            for (size_t x=x0; x<=x1; ++x) dst[GetOffsetX(x)] = src[x];
+        }
+    }
+}
+
+void Sampler::SetMapping(const unsigned char *lut)
+{
+    _mapped = (lut != 0);
+    if (_mapped) memcpy(_lut, lut, 256);
+    memset(_lut+256, 0, 4);
+}
+
+float Sampler::GetVoxel(float x, float y, float z) const
+{
+    // all 8 neighbours inside, no bounds checks
+    if (_buffer != 0 && x >= 0.0f && y >= 0.0f && z >= 0.0f && x < _xmax && y < _ymax && z < _zmax) {
+        size_t x0 = (size_t)x, y0 = (size_t)y, z0 = (size_t)z;
+        float fx = x-x0, fy = y-y0, fz = z-z0;
+        int c[8];
+        if (_layout == VOX_BRICK) {
+            const unsigned char *p = &_bricks[0];
+            size_t ox0 = GetOffsetX(x0), ox1 = GetOffsetX(x0+1);
+            size_t oy0 = GetOffsetY(y0), oy1 = GetOffsetY(y0+1);
+            size_t oz0 = GetOffsetZ(z0), oz1 = GetOffsetZ(z0+1);
+            c[0] = p[ox0+oy0+oz0]; c[1] = p[ox1+oy0+oz0];
+            c[2] = p[ox0+oy1+oz0]; c[3] = p[ox1+oy1+oz0];
+            c[4] = p[ox0+oy0+oz1]; c[5] = p[ox1+oy0+oz1];
+            c[6] = p[ox0+oy1+oz1]; c[7] = p[ox1+oy1+oz1];
+        }
+        else {
+            const unsigned char *p = _buffer + z0*_sz + y0*_sy + x0;
+            c[0] = p[0]; c[1] = p[1];
+            c[2] = p[_sy]; c[3] = p[_sy+1];
+            c[4] = p[_sz]; c[5] = p[_sz+1];
+            c[6] = p[_sz+_sy]; c[7] = p[_sz+_sy+1];
+        }
+        // corners are mapped before blending, as the shader does with the colormap
+        if (_mapped) for (int i=0; i<8; ++i) c[i] = _lut[c[i]];
+        float v00 = c[0] + (c[1]-c[0])*fx;
+        float v10 = c[2] + (c[3]-c[2])*fx;
+        float v01 = c[4] + (c[5]-c[4])*fx;
+        float v11 = c[6] + (c[7]-c[6])*fx;
+        float v0 = v00 + (v10-v00)*fy;
+        float v1 = v01 + (v11-v01)*fy;
+        return v0 + (v1-v0)*fz;
+    }
+    return GetVoxelRef(x, y, z);
+}
+
+float Sampler::GetVoxelRef(float x, float y, float z) const
+{
+    // border & out-of-core path, neighbours outside count as 0, the volume applies the mapping
+    if (_volume == 0 || !_volume->IsValid() || x < 0.0f || y < 0.0f || z < 0.0f)  return 0.0f;
+
+    size_t x0 = (size_t)x;
+    size_t x1 = x0+1;
+    size_t y0 = (size_t)y;
+    size_t y1 = y0+1;
+    size_t z0 = (size_t)z;
+    size_t z1 = z0+1;
+    unsigned char c[8]; // out-of-core bricks are resolved once for all 8 corners
+    _volume->GetCube(x0, y0, z0, c);
+    float xiy0z0 = c[0]*(x1-x) + c[1]*(x-x0);
+    float xiy1z0 = c[2]*(x1-x) + c[3]*(x-x0);
+    float xiyiz0 = xiy0z0*(y1-y) + xiy1z0*(y-y0);
+    float xiy0z1 = c[4]*(x1-x) + c[5]*(x-x0);
+    float xiy1z1 = c[6]*(x1-x) + c[7]*(x-x0);
+    float xiyiz1 = xiy0z1*(y1-y) + xiy1z1*(y-y0);
+    return xiyiz0*(z1-z) + xiyiz1*(z-z0);
+}
+
+void Sampler::GetVoxelsRef(const float *xyz, float *out, size_t n) const
+{
+    for (size_t i=0; i<n; ++i) out[i] = GetVoxelRef(xyz[3*i], xyz[3*i+1], xyz[3*i+2]);
+}
+
+#if defined(SAMPLER_X86)
+// lerp between the low 2 bytes of each lane, gathered x neighbours
+TARGET_AVX2 static inline __m256 LerpX(__m256i p, __m256 fx)
+{
+    const __m256i lo = _mm256_set1_epi32(0xFF);
+    __m256 a = _mm256_cvtepi32_ps(_mm256_and_si256(p, lo));
+    __m256 b = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(p, 8), lo));
+    return _mm256_add_ps(a, _mm256_mul_ps(_mm256_sub_ps(b, a), fx));
+}
+
+// map the low 2 bytes of each lane through a 256 entries LUT
+TARGET_AVX2 static inline __m256i MapLanes(__m256i p, const unsigned char *lut)
+{
+    const __m256i lo = _mm256_set1_epi32(0xFF);
+    const int *base = (const int*)lut;
+    __m256i a = _mm256_and_si256(_mm256_i32gather_epi32(base, _mm256_and_si256(p, lo), 1), lo);
+    __m256i b = _mm256_and_si256(_mm256_i32gather_epi32(base, _mm256_and_si256(_mm256_srli_epi32(p, 8), lo), 1), lo);
+    return _mm256_or_si256(a, _mm256_slli_epi32(b, 8));
+}
+
+TARGET_AVX2 static inline __m256 Lerp(__m256 a, __m256 b, __m256 w)
+{
+    return _mm256_add_ps(a, _mm256_mul_ps(_mm256_sub_ps(b, a), w));
+}
+
+// smallest of the lanes set in mask, 0 if none
+TARGET_AVX2 static inline int MinLane(__m256i v, __m256i mask)
+{
+    v = _mm256_blendv_epi8(_mm256_set1_epi32(0x7FFFFFFF), v, mask);
+    __m128i m = _mm_min_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    m = _mm_min_epi32(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(1, 0, 3, 2)));
+    m = _mm_min_epi32(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(2, 3, 0, 1)));
+    int first = _mm_cvtsi128_si32(m);
+    return (first == 0x7FFFFFFF) ? 0 : first;
+}
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+static inline float32x4_t Lerp(float32x4_t a, float32x4_t b, float32x4_t w)
+{
+    return vmlaq_f32(a, vsubq_f32(b, a), w);
+}
+#endif
+
+#if defined(SAMPLER_X86)
+TARGET_AVX2 size_t Sampler::GetVoxelsAVX2(const float *xyz, float *out, size_t n) const
+{
+    size_t i = 0;
+    // 8 lanes, x neighbours gathered in pairs as 32 bits words, lanes on the border, near the end or out of reach take the scalar path
+    // gather offsets are 32 bits, so they start from the lowest slice or brick layer of the 8 lanes, volumes may pass 2 GB
+    if (_buffer == 0) return 0;
+    if (_layout == VOX_BRICK) {
+        // bricks copy, corners from separable x y z offsets, no tail check thanks to the spare bytes
+        if (_bsz > 0x3FFFFFFF) return 0;
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 xmax = _mm256_set1_ps(_xmax), ymax = _mm256_set1_ps(_ymax), zmax = _mm256_set1_ps(_zmax);
+        const __m256i seven = _mm256_set1_epi32(7), one = _mm256_set1_epi32(1);
+        const __m256i bsy = _mm256_set1_epi32((int)_bsy), bsz = _mm256_set1_epi32((int)_bsz), stride = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+        const __m256i span = _mm256_set1_epi32((int)(0x7FFFFFFF/_bsz)-2); // brick layers within reach of the first one
+        for (; i+8<=n; i+=8) {
+            __m256 x = _mm256_i32gather_ps(xyz+3*i, stride, 4);
+            __m256 y = _mm256_i32gather_ps(xyz+3*i+1, stride, 4);
+            __m256 z = _mm256_i32gather_ps(xyz+3*i+2, stride, 4);
+            __m256 in = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(x, zero, _CMP_GE_OQ), _mm256_cmp_ps(x, xmax, _CMP_LT_OQ)),
+                _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(y, zero, _CMP_GE_OQ), _mm256_cmp_ps(y, ymax, _CMP_LT_OQ)),
+                _mm256_and_ps(_mm256_cmp_ps(z, zero, _CMP_GE_OQ), _mm256_cmp_ps(z, zmax, _CMP_LT_OQ))));
+            __m256 x0 = _mm256_floor_ps(_mm256_and_ps(x, in)), y0 = _mm256_floor_ps(_mm256_and_ps(y, in)), z0 = _mm256_floor_ps(_mm256_and_ps(z, in));
+            __m256i ix = _mm256_cvttps_epi32(x0), iy = _mm256_cvttps_epi32(y0), iz = _mm256_cvttps_epi32(z0);
+            __m256i iy1 = _mm256_add_epi32(iy, one), iz1 = _mm256_add_epi32(iz, one);
+            __m256i ox0 = _mm256_or_si256(_mm256_slli_epi32(_mm256_srli_epi32(ix, 3), 9), _mm256_and_si256(ix, seven));
+            __m256i oy0 = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_srli_epi32(iy, 3), bsy), _mm256_slli_epi32(_mm256_and_si256(iy, seven), 3));
+            __m256i oy1 = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_srli_epi32(iy1, 3), bsy), _mm256_slli_epi32(_mm256_and_si256(iy1, seven), 3));
+            int first = MinLane(_mm256_srli_epi32(iz, 3), _mm256_castps_si256(in));
+            const int *base = (const int*)(&_bricks[0] + first*_bsz);
+            __m256i bz0 = _mm256_sub_epi32(_mm256_srli_epi32(iz, 3), _mm256_set1_epi32(first)), bz1 = _mm256_sub_epi32(_mm256_srli_epi32(iz1, 3), _mm256_set1_epi32(first));
+            __m256i oz0 = _mm256_add_epi32(_mm256_mullo_epi32(bz0, bsz), _mm256_slli_epi32(_mm256_and_si256(iz, seven), 6));
+            __m256i oz1 = _mm256_add_epi32(_mm256_mullo_epi32(bz1, bsz), _mm256_slli_epi32(_mm256_and_si256(iz1, seven), 6));
+            __m256i mask = _mm256_and_si256(_mm256_castps_si256(in), _mm256_cmpgt_epi32(span, bz0)), none = _mm256_setzero_si256();
+            __m256 fx = _mm256_sub_ps(x, x0), fy = _mm256_sub_ps(y, y0), fz = _mm256_sub_ps(z, z0);
+            __m256i a = _mm256_add_epi32(_mm256_add_epi32(oy0, oz0), ox0), b = _mm256_add_epi32(_mm256_add_epi32(oy1, oz0), ox0);
+            __m256i c = _mm256_add_epi32(_mm256_add_epi32(oy0, oz1), ox0), d = _mm256_add_epi32(_mm256_add_epi32(oy1, oz1), ox0);
+            // x neighbours share a brick row unless x0 is the last of it, those lanes get the next brick voxel patched in
+            __m256i pa = _mm256_mask_i32gather_epi32(none, base, a, mask, 1), pb = _mm256_mask_i32gather_epi32(none, base, b, mask, 1);
+            __m256i pc = _mm256_mask_i32gather_epi32(none, base, c, mask, 1), pd = _mm256_mask_i32gather_epi32(none, base, d, mask, 1);
+            __m256i edge = _mm256_and_si256(mask, _mm256_cmpeq_epi32(_mm256_and_si256(ix, seven), seven));
+            if (!_mm256_testz_si256(edge, edge)) {
+                __m256i hop = _mm256_set1_epi32(512-7), lo = _mm256_set1_epi32(0xFF);
+                __m256i qa = _mm256_mask_i32gather_epi32(none, base, _mm256_add_epi32(a, hop), edge, 1), qb = _mm256_mask_i32gather_epi32(none, base, _mm256_add_epi32(b, hop), edge, 1);
+                __m256i qc = _mm256_mask_i32gather_epi32(none, base, _mm256_add_epi32(c, hop), edge, 1), qd = _mm256_mask_i32gather_epi32(none, base, _mm256_add_epi32(d, hop), edge, 1);
+                pa = _mm256_blendv_epi8(pa, _mm256_or_si256(_mm256_and_si256(pa, lo), _mm256_slli_epi32(_mm256_and_si256(qa, lo), 8)), edge);
+                pb = _mm256_blendv_epi8(pb, _mm256_or_si256(_mm256_and_si256(pb, lo), _mm256_slli_epi32(_mm256_and_si256(qb, lo), 8)), edge);
+                pc = _mm256_blendv_epi8(pc, _mm256_or_si256(_mm256_and_si256(pc, lo), _mm256_slli_epi32(_mm256_and_si256(qc, lo), 8)), edge);
+                pd = _mm256_blendv_epi8(pd, _mm256_or_si256(_mm256_and_si256(pd, lo), _mm256_slli_epi32(_mm256_and_si256(qd, lo), 8)), edge);
+            }
+            if (_mapped) {
+                pa = MapLanes(pa, _lut); pb = MapLanes(pb, _lut);
+                pc = MapLanes(pc, _lut); pd = MapLanes(pd, _lut);
+            }
+            __m256 v00 = LerpX(pa, fx), v10 = LerpX(pb, fx), v01 = LerpX(pc, fx), v11 = LerpX(pd, fx);
+            _mm256_storeu_ps(out+i, Lerp(Lerp(v00, v10, fy), Lerp(v01, v11, fy), fz));
+            int m = _mm256_movemask_ps(_mm256_castsi256_ps(mask));
+            if (m != 0xFF) {
+                for (int j=0; j<8; ++j)
+                    if (!(m & (1<<j))) out[i+j] = GetVoxel(xyz[3*(i+j)], xyz[3*(i+j)+1], xyz[3*(i+j)+2]);
+            }
+        }
+    }
+    else {
+        if (_sz > 0x3FFFFFFF) return 0;
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 xmax = _mm256_set1_ps(_xmax), ymax = _mm256_set1_ps(_ymax), zmax = _mm256_set1_ps(_zmax);
+        const __m256i sy = _mm256_set1_epi32((int)_sy), sz = _mm256_set1_epi32((int)_sz), syz = _mm256_set1_epi32((int)(_sy+_sz));
+        const __m256i span = _mm256_set1_epi32((int)(0x7FFFFFFF/_sz)-2), stride = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21); // slices within reach of the first one
+        for (; i+8<=n; i+=8) {
+            __m256 x = _mm256_i32gather_ps(xyz+3*i, stride, 4);
+            __m256 y = _mm256_i32gather_ps(xyz+3*i+1, stride, 4);
+            __m256 z = _mm256_i32gather_ps(xyz+3*i+2, stride, 4);
+            __m256 in = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(x, zero, _CMP_GE_OQ), _mm256_cmp_ps(x, xmax, _CMP_LT_OQ)),
+                _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(y, zero, _CMP_GE_OQ), _mm256_cmp_ps(y, ymax, _CMP_LT_OQ)),
+                _mm256_and_ps(_mm256_cmp_ps(z, zero, _CMP_GE_OQ), _mm256_cmp_ps(z, zmax, _CMP_LT_OQ))));
+            __m256 x0 = _mm256_floor_ps(_mm256_and_ps(x, in)), y0 = _mm256_floor_ps(_mm256_and_ps(y, in)), z0 = _mm256_floor_ps(_mm256_and_ps(z, in));
+            __m256i iz = _mm256_cvttps_epi32(z0);
+            int first = MinLane(iz, _mm256_castps_si256(in));
+            const int *base = (const int*)(_buffer + first*_sz);
+            size_t rest = _size - first*_sz - 3;
+            __m256i last = _mm256_set1_epi32((rest > 0x7FFFFFFF) ? 0x7FFFFFFF : (int)rest), rz = _mm256_sub_epi32(iz, _mm256_set1_epi32(first));
+            __m256i idx = _mm256_add_epi32(_mm256_cvttps_epi32(x0),
+                _mm256_add_epi32(_mm256_mullo_epi32(_mm256_cvttps_epi32(y0), sy), _mm256_mullo_epi32(rz, sz)));
+            __m256i mask = _mm256_and_si256(_mm256_and_si256(_mm256_castps_si256(in), _mm256_cmpgt_epi32(span, rz)), _mm256_cmpgt_epi32(last, _mm256_add_epi32(idx, syz)));
+            __m256i none = _mm256_setzero_si256();
+            __m256 fx = _mm256_sub_ps(x, x0), fy = _mm256_sub_ps(y, y0), fz = _mm256_sub_ps(z, z0);
+            __m256i pa = _mm256_mask_i32gather_epi32(none, base, idx, mask, 1), pb = _mm256_mask_i32gather_epi32(none, base, _mm256_add_epi32(idx, sy), mask, 1);
+            __m256i pc = _mm256_mask_i32gather_epi32(none, base, _mm256_add_epi32(idx, sz), mask, 1), pd = _mm256_mask_i32gather_epi32(none, base, _mm256_add_epi32(idx, syz), mask, 1);
+            if (_mapped) {
+                pa = MapLanes(pa, _lut); pb = MapLanes(pb, _lut);
+                pc = MapLanes(pc, _lut); pd = MapLanes(pd, _lut);
+            }
+            __m256 v00 = LerpX(pa, fx), v10 = LerpX(pb, fx), v01 = LerpX(pc, fx), v11 = LerpX(pd, fx);
+            _mm256_storeu_ps(out+i, Lerp(Lerp(v00, v10, fy), Lerp(v01, v11, fy), fz));
+            int m = _mm256_movemask_ps(_mm256_castsi256_ps(mask));
+            if (m != 0xFF) {
+                for (int j=0; j<8; ++j)
+                    if (!(m & (1<<j))) out[i+j] = GetVoxel(xyz[3*(i+j)], xyz[3*(i+j)+1], xyz[3*(i+j)+2]);
+            }
+        }
+    }
+    return i;
+}
+#endif
+
+void Sampler::GetVoxels(const float *xyz, float *out, size_t n) const
+{
+    size_t i = 0;
+#if defined(SAMPLER_X86)
+    // AVX2 is picked at run time with the remap kernels, Remap::SetLevel turns both down
+    if (Remap::GetLevel() == REMAP_AVX2) i = GetVoxelsAVX2(xyz, out, n);
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    // 4 lanes, NEON has no gathers so corners are loaded per lane & blended in vectors
+    if (_buffer != 0) {
+        for (; i+4<=n; i+=4) {
+            float c[8][4], fx[4], fy[4], fz[4];
+            int m = 0;
+            for (int j=0; j<4; ++j) {
+                float x = xyz[3*(i+j)], y = xyz[3*(i+j)+1], z = xyz[3*(i+j)+2];
+                fx[j] = fy[j] = fz[j] = 0.0f;
+                for (int k=0; k<8; ++k) c[k][j] = 0.0f;
+                if (!(x >= 0.0f && y >= 0.0f && z >= 0.0f && x < _xmax && y < _ymax && z < _zmax)) continue;
+                m |= 1<<j;
+                size_t x0 = (size_t)x, y0 = (size_t)y, z0 = (size_t)z;
+                if (_layout == VOX_BRICK) {
+                    const unsigned char *q = &_bricks[0];
+                    size_t ox0 = GetOffsetX(x0), ox1 = GetOffsetX(x0+1), oy0 = GetOffsetY(y0), oy1 = GetOffsetY(y0+1), oz0 = GetOffsetZ(z0), oz1 = GetOffsetZ(z0+1);
+                    c[0][j] = q[ox0+oy0+oz0]; c[1][j] = q[ox1+oy0+oz0];
+                    c[2][j] = q[ox0+oy1+oz0]; c[3][j] = q[ox1+oy1+oz0];
+                    c[4][j] = q[ox0+oy0+oz1]; c[5][j] = q[ox1+oy0+oz1];
+                    c[6][j] = q[ox0+oy1+oz1]; c[7][j] = q[ox1+oy1+oz1];
+                }
+                else {
+                    const unsigned char *q = _buffer + z0*_sz + y0*_sy + x0;
+                    c[0][j] = q[0]; c[1][j] = q[1];
+                    c[2][j] = q[_sy]; c[3][j] = q[_sy+1];
+                    c[4][j] = q[_sz]; c[5][j] = q[_sz+1];
+                    c[6][j] = q[_sz+_sy]; c[7][j] = q[_sz+_sy+1];
+                }
+                if (_mapped) for (int k=0; k<8; ++k) c[k][j] = _lut[(int)c[k][j]];
+                fx[j] = x-x0; fy[j] = y-y0; fz[j] = z-z0;
+            }
+            float32x4_t wx = vld1q_f32(fx), wy = vld1q_f32(fy), wz = vld1q_f32(fz);
+            float32x4_t v00 = Lerp(vld1q_f32(c[0]), vld1q_f32(c[1]), wx);
+            float32x4_t v10 = Lerp(vld1q_f32(c[2]), vld1q_f32(c[3]), wx);
+            float32x4_t v01 = Lerp(vld1q_f32(c[4]), vld1q_f32(c[5]), wx);
+            float32x4_t v11 = Lerp(vld1q_f32(c[6]), vld1q_f32(c[7]), wx);
+            vst1q_f32(out+i, Lerp(Lerp(v00, v10, wy), Lerp(v01, v11, wy), wz));
+            if (m != 0xF) {
+                for (int j=0; j<4; ++j)
+                    if (!(m & (1<<j))) out[i+j] = GetVoxel(xyz[3*(i+j)], xyz[3*(i+j)+1], xyz[3*(i+j)+2]);
+            }
+        }
+    }
+#endif
+    for (; i<n; ++i) out[i] = GetVoxel(xyz[3*i], xyz[3*i+1], xyz[3*i+2]);
+}
@@ -2,6 +2,7 @@
 
 #include <stdio.h>
 #include <math.h>
+#include <algorithm>
 #include <GL/glew.h>
 
 bool Soma::Read(const char *path)
@@ -26,9 +27,9 @@ bool Soma::Read(const char *path)
    
     if (_scale < 1.0f) _scale = 1.0f;
     for (size_t i=0; i<_list.size(); ++i) { // [0,S] -> [-1,1]
-        _list[i].X = (2.0f*_list[i].X-_width)/_scale;
-        _list[i].Y = (2.0f*_list[i].Y-_height)/_scale;
-        _list[i].Z = (2.0f*_list[i].Z-_depth)*_thickness/_scale;
+        _list[i].X = (2.0f*(_list[i].X-_offx)-_width)/_scale;
+        _list[i].Y = (2.0f*(_list[i].Y-_offy)-_height)/_scale;
+        _list[i].Z = (2.0f*(_list[i].Z-_offz)-_depth)*_thickness/_scale;
         _list[i].Radius = 2.0f*_list[i].Radius/_scale;
         _list[i].Value = _list[i].Value/255.0f;
     }
@@ -46,13 +47,14 @@ bool Soma::Write(const char *path) const
     fprintf(file, "# neuron soma APO model file\n");
     fprintf(file, "# created or edited by flNeuronTool\n");
     fprintf(file, "# width %d, height %d, depth %d\n", _width, _height, _depth);
+    if (_offx != 0 || _offy != 0 || _offz != 0) fprintf(file, "# offset x %d, y %d, z %d\n", (int)_offx, (int)_offy, (int)_offz);
     fprintf(file, "# line: x y z radius value\n\n");
     Cell cell;
     for (size_t i=0; i<_list.size(); ++i) { // [-1,1] -> [0,S]
         cell = _list[i];
-        cell.X = (_scale*cell.X+_width)/2.0f;
-        cell.Y = (_scale*cell.Y+_height)/2.0f;
-        cell.Z = (_scale/_thickness*cell.Z+_depth)/2.0f;
+        cell.X = (_scale*cell.X+_width)/2.0f + _offx;
+        cell.Y = (_scale*cell.Y+_height)/2.0f + _offy;
+        cell.Z = (_scale/_thickness*cell.Z+_depth)/2.0f + _offz;
         cell.Radius = _scale*cell.Radius/2.0f;
         cell.Value = cell.Value*255.0f;
         fprintf(file, "%.2f %.2f %.2f %.2f %.2f\n", cell.X, cell.Y, cell.Z, cell.Radius, cell.Value);
@@ -195,44 +197,115 @@ size_t Soma::AddPoint(const PCell &point)
     return AddCell(cell);
 }
 
-size_t Soma::Reduce(size_t start)
+// cells go to list one by one, each is dropped or merged into the first overlapping cell in list order
+static void Merge(std::vector<Cell> &list, const std::vector<Cell> &cells, bool merge, float scale)
+{
+    static const float rs = 0.61803399f;
+
+    // merged radii grow up to rs/(1-rs) times the largest incoming one, the grid reaches the farthest overlap
+    float in = 0.0f, out = 0.0f;
+    for (size_t i=0; i<cells.size(); ++i) in = std::max(in, cells[i].Radius);
+    for (size_t j=0; j<list.size(); ++j) out = std::max(out, list[j].Radius);
+    out = std::max(out, merge ? rs*in/(1.0f-rs) : in);
+    Grid<Cell> grid(std::max(rs*(in+out), 2.0f/scale));
+    for (size_t j=0; j<list.size(); ++j) grid.Insert(j, list[j]);
+
+    float dr, dx, dy, dz;
+    for (size_t i=0; i<cells.size(); ++i) {
+        const Cell &cell = cells[i];
+        size_t j = list.size();
+        int x, y, z;
+        grid.GetCell(cell, x, y, z);
+        for (int c=0; c<27; ++c) {
+            const std::vector<size_t> *bucket = grid.Find(x+c%3-1, y+c/3%3-1, z+c/9-1);
+            if (bucket == 0) continue;
+            for (size_t m=0; m<bucket->size(); ++m) {
+                size_t l = (*bucket)[m];
+                if (l >= j) continue;
+                dr = rs*(cell.Radius+list[l].Radius);
+                dx = abs(cell.X-list[l].X);
+                if (dx >= dr) continue;
+                dy = abs(cell.Y-list[l].Y);
+                if (dy >= dr) continue;
+                dz = abs(cell.Z-list[l].Z);
+                if (dz >= dr) continue;
+                if (dx*dx + dy*dy + dz*dz <= dr*dr) j = l;
+            }
+        }
+        if (j == list.size()) {
+            list.push_back(cell);
+            grid.Insert(j, cell);
+            continue;
+        }
+        if (merge) {
+            grid.Remove(j, list[j]);
+            list[j].X = (cell.X+list[j].X)/2.0f;
+            list[j].Y = (cell.Y+list[j].Y)/2.0f;
+            list[j].Z = (cell.Z+list[j].Z)/2.0f;
+            list[j].Radius = rs*(cell.Radius+list[j].Radius);
+            list[j].Value = (cell.Value+list[j].Value)/2.0f;
+            grid.Insert(j, list[j]);
+        }
+    }
+}
+
+// larger & brighter cells first, so they absorb the smaller candidates around, then by position
+static bool IsBefore(const Cell &a, const Cell &b)
+{
+    if (a.Radius != b.Radius) return a.Radius > b.Radius;
+    if (a.Value != b.Value) return a.Value > b.Value;
+    if (a.X != b.X) return a.X < b.X;
+    if (a.Y != b.Y) return a.Y < b.Y;
+    return a.Z < b.Z;
+}
+
+size_t Soma::Reduce(size_t start, bool parallel)
 {
     if (_list.empty() || start >= _list.size()) return _list.size();
 
     static const float rs = 0.61803399f;
 
     // copy optimal cells to temporary list
-    std::vector<Cell> list;
-    for (size_t i=0; i<start; ++i) list.push_back(_list[i]);
+    std::vector<Cell> list(_list.begin(), _list.begin()+start);
+    std::vector<Cell> cells(_list.begin()+start, _list.end());
 
-    // copy redundancy cells to temporary list & merge overlap
-    bool repeat;
-    float dr, dx, dy, dz;
-    for (size_t i=start; i<_list.size(); ++i) {
-        repeat = false;
-        for (size_t j=0; j<list.size(); ++j) {
-            dr = rs*(_list[i].Radius+list[j].Radius);
-            dx = abs(_list[i].X-list[j].X);
-            if (dx >= dr) continue;
-            dy = abs(_list[i].Y-list[j].Y);
-            if (dy >= dr) continue;
-            dz = abs(_list[i].Z-list[j].Z);
-            if (dz >= dr) continue;
-            if (dx*dx + dy*dy + dz*dz <= dr*dr) {
-                repeat = true;
-                if (_merge) {
-                    list[j].X = (_list[i].X+list[j].X)/2.0f;
-                    list[j].Y = (_list[i].Y+list[j].Y)/2.0f;
-                    list[j].Z = (_list[i].Z+list[j].Z)/2.0f;
-                    list[j].Radius = rs*(_list[i].Radius+list[j].Radius);
-                    list[j].Value = (_list[i].Value+list[j].Value)/2.0f;
-                }
-                break;
+    // slabs along the longest side are reduced apart, sorted by position, then their survivors are merged in slab order,
+    // slabs & orders only depend on the cells, so the result is the same whatever the threads & the probing order
+    if (parallel && cells.size() > 1) {
+        float lo[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, hi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX }, maxr = 0.0f;
+        for (size_t i=0; i<cells.size(); ++i) {
+            const float p[3] = { cells[i].X, cells[i].Y, cells[i].Z };
+            for (int k=0; k<3; ++k) {
+                lo[k] = std::min(lo[k], p[k]);
+                hi[k] = std::max(hi[k], p[k]);
             }
+            maxr = std::max(maxr, cells[i].Radius);
+        }
+        int axis = 0;
+        for (int k=1; k<3; ++k)
+            if (hi[k]-lo[k] > hi[axis]-lo[axis]) axis = k;
+        float extent = hi[axis]-lo[axis];
+        int count = (int)std::min(64.0f, std::max(1.0f, extent/(8.0f*std::max(2.0f*rs*maxr, 2.0f/_scale))));
+        std::vector<std::vector<Cell> > slabs(count);
+        for (size_t i=0; i<cells.size(); ++i) {
+            float p = (axis == 0) ? cells[i].X : (axis == 1) ? cells[i].Y : cells[i].Z;
+            int s = (extent > 0.0f) ? (int)((p-lo[axis])/extent*count) : 0;
+            slabs[std::min(s, count-1)].push_back(cells[i]);
+        }
+        #pragma omp parallel for schedule(dynamic)
+        for (int s=0; s<count; ++s) {
+            std::sort(slabs[s].begin(), slabs[s].end(), IsBefore);
+            std::vector<Cell> reduced;
+            Merge(reduced, slabs[s], _merge, _scale);
+            slabs[s].swap(reduced);
         }
-        if (!repeat) list.push_back(_list[i]);
+        cells.clear();
+        for (int s=0; s<count; ++s) cells.insert(cells.end(), slabs[s].begin(), slabs[s].end());
     }
 
+    // copy redundancy cells to temporary list & merge overlap
+    Merge(list, cells, _merge, _scale);
+
     // copy back optimal cells from temporary list
     _list.resize(list.size());
     std::copy(list.begin()+start, list.end(), _list.begin()+start);
@@ -4,14 +4,24 @@
 #include <math.h>
 #include <process.h>
 #include <time.h>
+#include <deque>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sched.h>
+#include <unistd.h>
+#endif
 
 void Tracing::SetParam()
 {
     if (_volume == 0 || _tree == 0) return;
 
     _tree->SetExtent(_volume->GetWidth(), _volume->GetHeight(), _volume->GetDepth(), _volume->GetThickness());
+    _tree->SetOffset(_volume->GetOffsetX(), _volume->GetOffsetY(), _volume->GetOffsetZ());
 
     float mean, low, high;
     _volume->GetValue(mean, low, high);
@@ -23,11 +33,22 @@ void Tracing::SetParam()
 
 void Tracing::SetParam(size_t x, size_t y, size_t z, size_t radius)
 {
+    Param param = GetParam(x, y, z, radius);
+    _high = param.High;
+    _low = param.Low;
+    _grads = param.Grads;
+}
+
+Tracing::Param Tracing::GetParam(size_t x, size_t y, size_t z, size_t radius) const
+{
+    // the precomputed field answers in constant time, the box scan is for out-of-core volumes
     float mean, low, high;
-    _volume->GetValue(mean, low, high, x, y, z, radius);
-    _high = (mean+high)/2.0f;
-    _low = (low+mean+high)/3.0f;
-    _grads = 255.0f-_low;
+    if (!_volume->GetLocalValue(mean, low, high, (float)x, (float)y, (float)z)) _volume->GetValue(mean, low, high, x, y, z, radius);
+    Param param = GetParam();
+    param.High = (mean+high)/2.0f;
+    param.Low = (low+mean+high)/3.0f;
+    param.Grads = 255.0f-param.Low;
+    return param;
 }
 
 void Tracing::AddSeed(const Point &seed)
@@ -42,38 +63,35 @@ void Tracing::AddSeed(const Point &seed)
     static const float pi = 3.14159265f;
     static const float bias = 2.0f, rs = 0.61803399f;
 
-    static glm::vec3 dirs[dim];
-    static float thickness = 0.0f;
-    if (thickness != _volume->GetThickness()) {
-        thickness = _volume->GetThickness();
-        int vth = 1, ith = 0;
-        for (int i=0; i<=udim/2; ++i) {
-            vth = glm::max(i*vdim, 1);
-            for (int j=0; j<vth; ++j) {
-                dirs[ith].x = glm::sin(i*pi/(udim-1))*glm::cos(j*2.0f*pi/vth);
-                dirs[ith].y = glm::sin(i*pi/(udim-1))*glm::sin(j*2.0f*pi/vth);
-                dirs[ith].z = glm::cos(i*pi/(udim-1))/thickness;
-                //dirs[ith] = glm::normalize(dirs[ith]);
-                dirs[dim/2+ith] = -1.0f*dirs[ith];
-                ++ith;
-                if (ith >= dim/2) break;
-            }
+    glm::vec3 dirs[dim];
+    float thickness = _volume->GetThickness();
+    int vth = 1, ith = 0;
+    for (int i=0; i<=udim/2; ++i) {
+        vth = glm::max(i*vdim, 1);
+        for (int j=0; j<vth; ++j) {
+            dirs[ith].x = glm::sin(i*pi/(udim-1))*glm::cos(j*2.0f*pi/vth);
+            dirs[ith].y = glm::sin(i*pi/(udim-1))*glm::sin(j*2.0f*pi/vth);
+            dirs[ith].z = glm::cos(i*pi/(udim-1))/thickness;
+            //dirs[ith] = glm::normalize(dirs[ith]);
+            dirs[dim/2+ith] = -1.0f*dirs[ith];
+            ++ith;
+            if (ith >= dim/2) break;
         }
-    } 
+    }
 
-    static PNode point0, point1, points[dim];
+    PNode point0, point1, points[dim];
+    Rays rays;
+    rays.SetOrigin(point.X, point.Y, point.Z, point.Value);
+    rays.SetStop(_low, _high, _grads, FLT_MAX);
+    for (int i=0; i<dim; ++i) rays.AddRay(dirs[i].x, dirs[i].y, dirs[i].z);
+    rays.Cast(_volume->GetSampler(), 0.0f, 0.5f);
     for (int i=0; i<dim; ++i) {
-        point1 = point;
-        point1.Radius = 0.0f;
-        do {
-            point0 = point1;
-            point1.Radius += 0.5f;
-            point1.X = point.X + dirs[i].x*point1.Radius;
-            point1.Y = point.Y + dirs[i].y*point1.Radius;
-            point1.Z = point.Z + dirs[i].z*point1.Radius;
-            point1.Value = _volume->GetVoxel(point1);
-        } while (point1.Value >= _high || point1.Value >= _low && abs(point1.Value-point.Value) <= _grads);
-        points[i] = point0;
+        points[i] = point;
+        points[i].X = rays.GetX(i);
+        points[i].Y = rays.GetY(i);
+        points[i].Z = rays.GetZ(i);
+        points[i].Value = rays.GetValue(i);
+        points[i].Radius = rays.GetRadius(i);
     }
    
     point.X = point.Y = point.Z = point.Value = point.Radius = 0.0f;
@@ -118,84 +136,328 @@ void Tracing::AddSeed(const Point &seed)
 
 void Tracing::BeginUpdate()
 {
-    if (_volume==0 || _tree==0 || _seeds.empty() || _doing) return;
+    if (_volume==0 || _tree==0 || _seeds.empty() || _doing || _volume->IsLoading()) return;
     
     _beginthread(Tracing::UpdateThread, 0, (void*)this);
     _cancel = false;
 }
 
+// one node of the parallel tracing, children kept in the order Advance returned them
+// [Lo,Hi) & Depth place it in the serial stack order: Lo first, an ancestor sharing its Lo before it
+struct Branch {
+    Branch() : Parent(0), Lo(0), Hi(0), Depth(0), Dropped(0), Done(false) {}
+    PNode Node;
+    Branch *Parent;
+    std::vector<Branch*> Children;
+    unsigned long long Lo, Hi;
+    unsigned Depth;
+    int Dropped; // a tube before it in the serial order covers it or an ancestor, set & read atomically
+    bool Done;
+};
+
+// child i of n splits the parent range in the order the stack pops them, the last child first
+// a range too narrow to split is shared, the serial pass then settles what the order misses
+static void SetOrder(const Branch &parent, Branch &child, size_t i, size_t n)
+{
+    unsigned long long w = (parent.Hi-parent.Lo)/n;
+    child.Lo = parent.Lo;
+    child.Hi = parent.Hi;
+    child.Depth = parent.Depth+1;
+    if (n < 2 || w == 0) return;
+    child.Lo = parent.Lo + (n-1-i)*w;
+    child.Hi = child.Lo + w;
+}
+
+// a branch under an ancestor found in a tube before it in the serial order is dropped unseen by the serial pass,
+// the last ancestors are looked at when it is picked, so a subtree stolen ahead stops soon after the tube shows up
+static bool IsDropped(const Branch *branch, const Occupancy &occupancy)
+{
+    static const int ancestors = 16;
+    Branch *parent = branch->Parent;
+    int k = 0;
+    for (const Branch *a=parent; a!=0 && a->Parent!=0 && k<ancestors; a=a->Parent, ++k) {
+        int dropped;
+        #pragma omp atomic read
+        dropped = a->Dropped;
+        if (dropped != 0 || occupancy.IsOccupied(a->Node.X, a->Node.Y, a->Node.Z, a->Lo, a->Depth)) {
+            #pragma omp atomic write
+            parent->Dropped = 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+// idle thread waits for stolen work, a few yields then 1 ms sleeps so it leaves the cores & the locks to the busy ones
+static void Backoff(int &idle)
+{
+#ifdef _WIN32
+    if (++idle <= 16) SwitchToThread();
+    else Sleep(1);
+#else
+    if (++idle <= 16) sched_yield();
+    else usleep(1000);
+#endif
+}
+
+// tubes of the first len nodes of the tree, stamped at the core so close siblings & crossings still pass
+static void StampTree(Occupancy &occupancy, const Tree *tree, size_t len, float rs)
+{
+    for (size_t i=0; i<len; ++i) {
+        PNode point = tree->GetPoint(i), parent = point;
+        if (point.Pid > 0 && (size_t)point.Pid <= len && tree->GetNode(point.Pid-1).Id == (size_t)point.Pid) parent = tree->GetPoint(point.Pid-1);
+        occupancy.Stamp(parent, point, rs*point.Radius);
+    }
+}
+
+// branches deque of a tracing thread, the owner works at the back like the serial stack,
+// idle threads steal the oldest branches at the front, the roots of the largest subtrees
+struct Worker {
+    Worker() : Traced(0) { omp_init_lock(&Lock); }
+    ~Worker() { omp_destroy_lock(&Lock); }
+    std::deque<Branch*> Tasks;
+    std::deque<Branch> Branches; // storage of the branches this thread found, addresses stay valid as it grows
+    size_t Traced;
+    omp_lock_t Lock;
+};
+
 void Tracing::Update()
 {
     if (_volume==0 || _tree==0 || _seeds.empty() || _doing) return;
 
     _doing = true;
-    float params[4];
-    if (_local) {
-        params[0] = _radius;
-        params[1] = _high;
-        params[2] = _low;
-        params[3] = _grads;
-    }
-
+    _last = _seeds;
     size_t len = _tree->GetSize();
-    printf("[Tracing::Update] tracing starting, there are %d nodes in tree model\n", len);
+    printf("[Tracing::Update] tracing starting, there are %d nodes in tree model\n", (int)len);
 
     clock_t t = clock();
-    std::vector<PNode> children;
-    while (!_seeds.empty()) {
-        PNode seed = _seeds.top();
+    // tubes of the tree so far, the threads stamp theirs as they go & skip children landing in tubes before them in the serial order
+    static const float rs = 0.61803399f;
+    Occupancy occupancy;
+    if (_occupy) {
+        occupancy.Reset(_volume->GetWidth(), _volume->GetHeight(), _volume->GetDepth(), _volume->GetThickness());
+        StampTree(occupancy, _tree, len, rs);
+    }
+
+    // seeds in the serial popping order, the top of the stack first, ranges from 1 so the tree so far comes first
+    std::vector<Branch> roots(_seeds.size());
+    unsigned long long span = (~0ULL-1)/std::max(roots.size(), (size_t)1);
+    for (size_t i=0; i<roots.size(); ++i) {
+        roots[i].Node = _seeds.top();
+        roots[i].Lo = 1 + i*span;
+        roots[i].Hi = roots[i].Lo + span;
         _seeds.pop();
+    }
+
+    int count = omp_get_max_threads();
+    Worker *workers = new Worker[count];
+    for (size_t i=roots.size(); i-- > 0;) workers[0].Tasks.push_back(&roots[i]);
+    long pending = (long)roots.size(); // branches queued or being traced
+    omp_lock_t lock;
+    omp_init_lock(&lock);
+    #pragma omp parallel num_threads(count)
+    {
+        int id = omp_get_thread_num();
+        Worker &worker = workers[id];
+        std::vector<PNode> children;
+        int idle = 0;
+        while (!_cancel) {
+            Branch *branch = 0;
+            omp_set_lock(&worker.Lock);
+            if (!worker.Tasks.empty()) {
+                branch = worker.Tasks.back();
+                worker.Tasks.pop_back();
+            }
+            omp_unset_lock(&worker.Lock);
+            for (int k=1; k<count && branch==0; ++k) {
+                Worker &victim = workers[(id+k)%count];
+                omp_set_lock(&victim.Lock);
+                if (!victim.Tasks.empty()) {
+                    branch = victim.Tasks.front();
+                    victim.Tasks.pop_front();
+                }
+                omp_unset_lock(&victim.Lock);
+            }
+            if (branch == 0) {
+                omp_set_lock(&lock);
+                bool done = (pending == 0);
+                omp_unset_lock(&lock);
+                if (done) break;
+                Backoff(idle);
+                continue;
+            }
+            idle = 0;
+
+            // a child landing in a tube traced before it in the serial order ends its branch, seeds always start
+            // tubes later in that order are not looked at, which leaves the serial pass little to redo
+            // ids are live for the view & the children links, they are renumbered once all threads are done
+            PNode &seed = branch->Node;
+            if (!_occupy || branch->Parent == 0 || (!occupancy.IsOccupied(seed.X, seed.Y, seed.Z, branch->Lo, branch->Depth) && !IsDropped(branch, occupancy))) {
+                seed.Id = _tree->AddPoint(seed);
+                if (_occupy) occupancy.Stamp((branch->Parent != 0) ? branch->Parent->Node : seed, seed, rs*seed.Radius, branch->Lo, branch->Depth);
+                Advance(seed, children, _local ? GetParam(seed, 5.0f) : GetParam());
+                for (size_t i=0; i<children.size(); ++i) {
+                    worker.Branches.push_back(Branch());
+                    worker.Branches.back().Node = children[i];
+                    worker.Branches.back().Parent = branch;
+                    SetOrder(*branch, worker.Branches.back(), i, children.size());
+                    branch->Children.push_back(&worker.Branches.back());
+                }
+                branch->Done = true;
+                ++worker.Traced;
+            }
+
+            // counted before they are shared, so pending never drops to 0 with work left
+            omp_set_lock(&lock);
+            pending += (long)children.size()-1;
+            long left = pending;
+            omp_unset_lock(&lock);
+            omp_set_lock(&worker.Lock);
+            for (size_t i=0; i<branch->Children.size(); ++i) worker.Tasks.push_back(branch->Children[i]);
+            omp_unset_lock(&worker.Lock);
+            children.clear();
+            if (id == 0) printf("[Tracing::Update] there are %d seeds, %d nodes in tree model\r", (int)left, (int)_tree->GetSize());
+        }
+    }
+    omp_destroy_lock(&lock);
+    if (_cancel) printf("[Tracing::Update] tracing canceled and return now\n");
+
+    // add the traced nodes again in the order of the single thread stack, so ids & links match the serial tracing
+    // occupancy is checked again in that order: a branch the threads kept before the tube over it was stamped goes
+    // with its subtree, one skipped by the tube of a branch the serial order drops, or of a shared range, is traced here
+    while (_tree->GetSize() > len) _tree->Remove();
+    Occupancy serial;
+    if (_occupy) {
+        serial.Reset(_volume->GetWidth(), _volume->GetHeight(), _volume->GetDepth(), _volume->GetThickness());
+        StampTree(serial, _tree, len, rs);
+    }
+    std::deque<Branch> branches; // children of the branches traced here
+    std::vector<PNode> children;
+    size_t retraced = 0;
+    std::stack<Branch*> order;
+    for (size_t i=roots.size(); i-- > 0;) order.push(&roots[i]);
+    while (!order.empty()) {
+        Branch *branch = order.top();
+        order.pop();
+        PNode &seed = branch->Node;
+        if (!branch->Done && (!_occupy || _cancel)) continue;
+        if (_occupy && branch->Parent != 0 && serial.IsOccupied(seed.X, seed.Y, seed.Z)) continue;
         seed.Id = _tree->AddPoint(seed);
-        if (_local) SetParam(seed, 5.0f);
-        Advance(seed, children);
-        //while (!children.empty()) {
-        //    if (children.size() == 1) {
-        //        seed = children[0];
-        //        seed.Id = _tree->AddPoint(seed);
-        //        if (_local) SetParam(seed, 5.0f);
-        //        Advance(seed, children);
-        //        continue;
-        //    }
-        //    if (children.size() > 1) {
-        //        for (size_t i=0; i<children.size(); ++i)
-        //            _seeds.push(children[i]);
-        //        children.clear();
-        //        continue;
-        //    }
-        //}
-        if (!children.empty()) {
-            for (size_t i=0; i<children.size(); ++i)
-                _seeds.push(children[i]);
+        if (_occupy) serial.Stamp((branch->Parent != 0) ? branch->Parent->Node : seed, seed, rs*seed.Radius);
+        if (!branch->Done) {
+            Advance(seed, children, _local ? GetParam(seed, 5.0f) : GetParam());
+            for (size_t i=0; i<children.size(); ++i) {
+                branches.push_back(Branch());
+                branches.back().Node = children[i];
+                branches.back().Parent = branch;
+                SetOrder(*branch, branches.back(), i, children.size());
+                branch->Children.push_back(&branches.back());
+            }
             children.clear();
+            branch->Done = true;
+            ++retraced;
         }
-        printf("[Tracing::Update] there are %d seeds, %d nodes in tree model\r", _seeds.size(), _tree->GetSize());
-        if (_cancel) {
-            printf("[Tracing::Update] tracing canceled and return now\n");
-
-            while (!_seeds.empty()) _seeds.pop();
+        for (size_t i=0; i<branch->Children.size(); ++i) {
+            branch->Children[i]->Node.Pid = (long)seed.Id;
+            order.push(branch->Children[i]);
         }
     }
-    printf("[Tracing::Update] tracing finished, there are %d nodes in tree model (%ld ms)\n", _tree->GetSize(), clock()-t);
+    size_t traced = 0, kept = _tree->GetSize()-len;
+    for (int i=0; i<count; ++i) traced += workers[i].Traced;
+    delete[] workers;
+    printf("[Tracing::Update] tracing finished with %d threads, there are %d nodes in tree model (%ld ms)\n", count, (int)_tree->GetSize(), clock()-t);
+    if (_occupy) printf("[Tracing::Update] occupancy of traced tubes holds %d bricks, of %d nodes kept %d are traced again & %d of %d traced by the threads dropped in the serial order\n",
+        (int)serial.GetResident(), (int)kept, (int)retraced, (int)(traced+retraced-kept), (int)traced);
 
     //t = clock();
     //_tree->Reduce(len);
     //printf("[Tracing::Update] simplify tree model to %d nodes (%ld ms)\n", _tree->GetSize(), clock()-t);
 
-    if (_local) {
-        _radius = params[0];
-        _high = params[1];
-        _low = params[2];
-        _grads = params[3];
-    }
     _doing = false;
 }
 
-void Tracing::Advance(PNode &point, std::vector<PNode> &children) const
+void Tracing::BeginBenchmark()
 {
-    static const int udim = 7, vdim = 8, dim = 2*udim-1; // 5 7
-    static const float pi = 3.14159265f;
-    static const float as = 0.80901699f; // 0.80901699f 0.92387953f 0.96592583f
-    static const float bias = 1.0f, dist = 3.5f, step = 3.0f; // 1.41421356f 1.73205081f 2.23606798f 2.82842712f
+    if (_volume==0 || _tree==0 || _last.empty() || _doing || _volume->IsLoading()) return;
+
+    _beginthread(Tracing::BenchmarkThread, 0, (void*)this);
+    _cancel = false;
+}
+
+void Tracing::Benchmark()
+{
+    if (_volume==0 || _tree==0 || _doing) return;
+    if (_last.empty() || _volume->IsBricked()) {
+        printf("[Tracing::Benchmark] benchmark needs a finished tracing of an in-memory volume\n");
+        return;
+    }
+
+    // the last tracing is replayed into a scratch tree, so the user tree is left untouched
+    static const char *names[] = { "linear", "8x8x8 bricks" };
+    int layout = _volume->GetLayout();
+    Tree *tree = _tree;
+    std::stack<PNode> seeds = _last;
+    for (int i=VOX_LINEAR; i<=VOX_BRICK && !_cancel; ++i) {
+        Tree scratch;
+        scratch.SetExtent(_volume->GetWidth(), _volume->GetHeight(), _volume->GetDepth(), _volume->GetThickness());
+        _volume->SetLayout(i);
+        _tree = &scratch;
+        _seeds = seeds;
+        clock_t t = clock();
+        Update();
+        t = clock()-t;
+        printf("[Tracing::Benchmark] %s voxel layout traced %d nodes (%ld ms, %.1f nodes/s)\n", names[i], (int)scratch.GetSize(), t, scratch.GetSize()*1000.0/(t > 0 ? t : 1));
+    }
+    _tree = tree;
+    _volume->SetLayout(layout);
+    _last = seeds;
+}
+
+// rays of Advance, udim rings of vdim*i directions in a cone around z
+// built at startup, so tracing threads only ever read them
+struct Cone {
+    enum { udim = 7, vdim = 8, dim = 2*udim-1 }; // 5 7
+    glm::vec3 Dirs[dim*dim];
+    Cone() {
+        static const float pi = 3.14159265f;
+        static const float as = 0.80901699f; // 0.80901699f 0.92387953f 0.96592583f
+        static const float bias = 1.0f;
+        int vth = 1, ith = 0;
+        for (int i=0; i<udim; ++i) {
+            vth = glm::max(i*vdim, 1);
+            for (int j=0; j<vth; ++j) {
+                Dirs[ith].x = glm::sin(i*as*0.5f*pi/(udim-1))*glm::cos(j*2.0f*pi/vth);
+                Dirs[ith].y = glm::sin(i*as*0.5f*pi/(udim-1))*glm::sin(j*2.0f*pi/vth);
+                Dirs[ith].z = bias*glm::cos(i*as*0.5f*pi/(udim-1));
+                Dirs[ith] = glm::normalize(Dirs[ith]);
+                ++ith;
+            }
+        }
+    }
+};
+
+// rays of RefinePoint, a ring in the xy plane
+struct Ring {
+    enum { dim = 16 };
+    glm::vec3 Dirs[dim];
+    Ring() {
+        static const float pi = 3.14159265f;
+        for (int i=0; i<dim/2; ++i) {
+            Dirs[i].x = cos(i*2.0f*pi/dim);
+            Dirs[i].y = sin(i*2.0f*pi/dim);
+            Dirs[i].z = 0.0f;
+            Dirs[dim/2+i] = -1.0f*Dirs[i];
+        }
+    }
+};
+
+static const Cone cone;
+static const Ring ring;
+
+void Tracing::Advance(PNode &point, std::vector<PNode> &children, const Param &param) const
+{
+    static const int dim = Cone::dim;
+    static const float dist = 3.5f, step = 3.0f; // 1.41421356f 1.73205081f 2.23606798f 2.82842712f
     static const float ds =  0.98078528f; // 0.92387953f 0.98078528f
 
     // udim = 5, dim = 9
@@ -248,22 +510,8 @@ void Tracing::Advance(PNode &point, std::vector<PNode> &children) const
         118, 103,  88,  73,  58,  43,  28,  27,  26,  25,  24,  23,  22,  21,  20,  19,  18,  17,  16,  31,  46,  61,  76,  91, 106, 121, 136, 151, 166, 181, 196, 197, 198, 199, 200, 201, 202, 203, 204, 205, 206, 207, 208, 193, 178, 163, 148, 133, 
     };
 
-    static glm::vec3 dirs[dim*dim];
-    static bool first = true;
-    if (first) {
-        first = false;
-        int vth = 1, ith = 0;
-        for (int i=0; i<udim; ++i) {
-            vth = glm::max(i*vdim, 1);
-            for (int j=0; j<vth; ++j) {
-                dirs[ith].x = glm::sin(i*as*0.5f*pi/(udim-1))*glm::cos(j*2.0f*pi/vth);
-                dirs[ith].y = glm::sin(i*as*0.5f*pi/(udim-1))*glm::sin(j*2.0f*pi/vth);
-                dirs[ith].z = bias*glm::cos(i*as*0.5f*pi/(udim-1));
-                dirs[ith] = glm::normalize(dirs[ith]);
-                ++ith;
-            }
-        }
-    }
+    // read ahead bricks of out-of-core volume along the tracing direction
+    _volume->Prefetch(point, point.I, point.J, point.K, _dist*param.Radius);
 
     glm::vec3 line(point.I, point.J, point.K);
     glm::vec3 zaxis(0.0f, 0.0f, 1.0f);
@@ -271,28 +519,30 @@ void Tracing::Advance(PNode &point, std::vector<PNode> &children) const
     float angle = glm::degrees(glm::acos(glm::dot(zaxis, line)));
     glm::mat4 matrix = glm::rotate(glm::mat4(), angle, axis);
     
-    static PNode point0, point1, points[dim*dim];
+    // scratch on the stack, one set per tracing thread
+    PNode point0, points[dim*dim];
+    Rays rays;
+    rays.SetOrigin(point.X, point.Y, point.Z, point.Value);
+    rays.SetStop(param.Low, 256.0f, param.Grads, _dist*param.Radius);
+    for (int i=0; i<dim*dim; ++i) {
+        points[i] = point;
+        points[i].Pid = point.Id;
+        glm::vec4 dir = matrix*glm::vec4(cone.Dirs[i], 1.0f);
+        points[i].I = dir.x;
+        points[i].J = dir.y;
+        points[i].K = dir.z/_volume->GetThickness();
+        rays.AddRay(points[i].I, points[i].J, points[i].K);
+    }
+    rays.Cast(_volume->GetSampler(), 0.5f, 0.5f);
     for (int i=0; i<dim*dim; ++i) {
-        point1 = point;
-        point1.Pid = point.Id;
-        //point1.Radius *= 0.5f;
-        point1.Radius = 0.5f;
-        glm::vec4 dir = matrix*glm::vec4(dirs[i], 1.0f);
-        point1.I = dir.x;
-        point1.J = dir.y;
-        point1.K = dir.z/_volume->GetThickness();
-        do {
-            point0 = point1;
-            point1.Radius += 0.5f;
-            point1.X = point.X + point1.I*point1.Radius;
-            point1.Y = point.Y + point1.J*point1.Radius;
-            point1.Z = point.Z + point1.K*point1.Radius;
-            point1.Value = _volume->GetVoxel(point1);
-        } while (point1.Radius <= _dist*_radius && point1.Value >= _low && abs(point1.Value-point.Value) <= _grads);
-        points[i] = point0;
+        points[i].X = rays.GetX(i);
+        points[i].Y = rays.GetY(i);
+        points[i].Z = rays.GetZ(i);
+        points[i].Value = rays.GetValue(i);
+        points[i].Radius = rays.GetRadius(i);
     }
 
-    static unsigned char image[(dim+2)*(dim+2)];
+    unsigned char image[(dim+2)*(dim+2)];
     memset(image, 0, (dim+2)*(dim+2)*sizeof(unsigned char));
     for (int i=0; i<dim*dim; ++i) {
         if (points[i].Radius < dist*point.Radius) {
@@ -314,7 +564,7 @@ void Tracing::Advance(PNode &point, std::vector<PNode> &children) const
     for (int i=0; i<dim*dim; ++i) {
         if (image[ids[i]] > 0) {
             point0 = points[i];
-            RefinePoint(point, point0);
+            RefinePoint(point, point0, param);
             if (point.I*point0.I + point.J*point0.J + point.K*point0.K <= 0.0f) continue;
             if (children.empty()) {
                 children.push_back(point0);
@@ -382,26 +632,14 @@ void Tracing::GetCenter(unsigned char *image, size_t dimension) const
     delete[] value;
 }
 
-void Tracing::RefinePoint(PNode &parent, PNode &point) const
+void Tracing::RefinePoint(PNode &parent, PNode &point, const Param &param) const
 {
-    static const size_t dim = 16;
-    static const float pi = 3.14159265f;
+    static const int dim = Ring::dim;
     static const float ds = 0.98078528f; // cos(pi/16)
     static const float rs = 0.61803399f;
 
-    static glm::vec3 dirs[dim];
-    static bool first = true;
-    if (first) {
-        first = false;
-        for (int i=0; i<dim/2; ++i) {
-            dirs[i].x = cos(i*2.0f*pi/dim);
-            dirs[i].y = sin(i*2.0f*pi/dim);
-            dirs[i].z = 0.0f;
-            dirs[dim/2+i] = -1.0f*dirs[i];
-        }
-    }
-
-    static PNode point0, point1, points[dim];  
+    PNode point0, points[dim];
+    Rays rays;
     do {
         glm::vec3 line(point.I, point.J, point.K);
         glm::vec3 zaxis(0.0f, 0.0f, 1.0f);
@@ -409,24 +647,23 @@ void Tracing::RefinePoint(PNode &parent, PNode &point) const
         float angle = glm::degrees(glm::acos(glm::dot(zaxis, line)));
         glm::mat4 matrix = glm::rotate(glm::mat4(), angle, axis);
 
+        rays.Clear();
+        rays.SetOrigin(point.X, point.Y, point.Z, point.Value);
+        rays.SetStop(param.Low, 256.0f, param.Grads, param.Radius);
         for (int i=0; i<dim; ++i) {
-            point1 = point;
-            point1.Radius = 0.0f;
-            glm::vec4 dir = matrix*glm::vec4(dirs[i], 1.0f);
+            glm::vec4 dir = matrix*glm::vec4(ring.Dirs[i], 1.0f);
             dir.z /= _volume->GetThickness();
             dir = glm::normalize(dir);
-            point1.I = dir.x;
-            point1.J = dir.y;
-            point1.K = dir.z;
-            do {
-                point0 = point1;
-                point1.Radius += 0.5f;
-                point1.X = point.X + point1.I*point1.Radius;
-                point1.Y = point.Y + point1.J*point1.Radius;
-                point1.Z = point.Z + point1.K*point1.Radius;
-                point1.Value = _volume->GetVoxel(point1);
-            } while (point1.Radius <= _radius && point1.Value >= _low && abs(point1.Value-point.Value) <= _grads);
-            points[i] = point0;
+            rays.AddRay(dir.x, dir.y, dir.z);
+        }
+        rays.Cast(_volume->GetSampler(), 0.0f, 0.5f);
+        for (int i=0; i<dim; ++i) {
+            points[i] = point;
+            points[i].X = rays.GetX(i);
+            points[i].Y = rays.GetY(i);
+            points[i].Z = rays.GetZ(i);
+            points[i].Value = rays.GetValue(i);
+            points[i].Radius = rays.GetRadius(i);
         }
 
         point0 = point;
@@ -2,6 +2,7 @@
 
 #include <stdio.h>
 #include <math.h>
+#include <algorithm>
 #include <GL/glew.h>
 #include <glm/glm.hpp>
 
@@ -28,9 +29,9 @@ bool Tree::Read(const char *path)
 
     if (_scale < 1.0f) _scale = 1.0f;
     for (size_t i=0; i<_list.size(); ++i) { // [0,S] -> [-1,1]
-        _list[i].X = (2.0f*_list[i].X-_width)/_scale;
-        _list[i].Y = (2.0f*_list[i].Y-_height)/_scale;
-        _list[i].Z = (2.0f*_list[i].Z-_depth)*_thickness/_scale;
+        _list[i].X = (2.0f*(_list[i].X-_offx)-_width)/_scale;
+        _list[i].Y = (2.0f*(_list[i].Y-_offy)-_height)/_scale;
+        _list[i].Z = (2.0f*(_list[i].Z-_offz)-_depth)*_thickness/_scale;
         _list[i].Radius = 2.0f*_list[i].Radius/_scale;
     }
     return true;
@@ -47,13 +48,14 @@ bool Tree::Write(const char *path) const
     fprintf(file, "# neuron tree SWC model file\n");
     fprintf(file, "# created or edited by flNeuronTool\n");
     fprintf(file, "# width %d, height %d, depth %d\n", _width, _height, _depth);
+    if (_offx != 0 || _offy != 0 || _offz != 0) fprintf(file, "# offset x %d, y %d, z %d\n", (int)_offx, (int)_offy, (int)_offz);
     fprintf(file, "# line: id tag x y z radius pid\n\n");
     Node node;
     for (size_t i=0; i<_list.size(); ++i) {
         node = _list[i];
-        node.X = (_scale*node.X+_width)/2.0f;
-        node.Y = (_scale*node.Y+_height)/2.0f;
-        node.Z = (_scale/_thickness*node.Z+_depth)/2.0f;
+        node.X = (_scale*node.X+_width)/2.0f + _offx;
+        node.Y = (_scale*node.Y+_height)/2.0f + _offy;
+        node.Z = (_scale/_thickness*node.Z+_depth)/2.0f + _offz;
         node.Radius = _scale*node.Radius/2.0f;
         if (node.Pid <= 0)  node.Pid = -1;
         fprintf(file, "%d %d %.2f %.2f %.2f %.2f %d\n", node.Id, node.Tag, node.X, node.Y, node.Z, node.Radius, node.Pid);
@@ -313,31 +315,82 @@ PNode Tree::GetPoint(size_t id) const
 size_t Tree::AddPoint(const PNode &point)
 {
     Node node; // [0,S] -> [-1,1]
-    node.Id = _list.size() + 1;
     node.X = (2.0f*point.X-_width)/_scale;
     node.Y = (2.0f*point.Y-_height)/_scale;
     node.Z = (2.0f*point.Z-_depth)*_thickness/_scale;
     node.Radius = 2.0f*point.Radius/_scale;
     node.Pid = point.Pid;
-    return AddNode(node);
+    omp_set_lock(&_lock);
+    node.Id = _list.size() + 1;
+    AddNode(node);
+    omp_unset_lock(&_lock);
+    return node.Id;
 }
 
+// k-d tree over node positions, every subtree keeps its lowest node index,
+// so a query can be limited to the nodes before a given one
+struct KdTree {
+    struct Less {
+        Less(const std::vector<Node> &list, int axis) : List(list), Axis(axis) {}
+        bool operator()(size_t a, size_t b) const { return KdTree::Get(List[a], Axis) < KdTree::Get(List[b], Axis); }
+        const std::vector<Node> &List;
+        int Axis;
+    };
+    KdTree(const std::vector<Node> &list) : List(list), Order(list.size()), Low(list.size()) {
+        for (size_t i=0; i<Order.size(); ++i) Order[i] = i;
+        Build(0, Order.size(), 0);
+    }
+    static float Get(const Node &node, int axis) { return (axis == 0) ? node.X : (axis == 1) ? node.Y : node.Z; }
+    size_t Build(size_t lo, size_t hi, int axis) {
+        if (lo >= hi) return List.size();
+        size_t mid = (lo+hi)/2;
+        std::nth_element(Order.begin()+lo, Order.begin()+mid, Order.begin()+hi, Less(List, axis));
+        Low[mid] = std::min(Order[mid], std::min(Build(lo, mid, (axis+1)%3), Build(mid+1, hi, (axis+1)%3)));
+        return Low[mid];
+    }
+    // nearest node before index before within squared distance best, the lowest index on ties
+    void Find(const Node &node, size_t before, float &best, size_t &id) const { Find(node, before, best, id, 0, Order.size(), 0); }
+    void Find(const Node &node, size_t before, float &best, size_t &id, size_t lo, size_t hi, int axis) const {
+        if (lo >= hi) return;
+        size_t mid = (lo+hi)/2;
+        if (Low[mid] >= before) return;
+        size_t j = Order[mid];
+        if (j < before) {
+            float dx = node.X-List[j].X, dy = node.Y-List[j].Y, dz = node.Z-List[j].Z;
+            float d = dx*dx + dy*dy + dz*dz;
+            if (d < best || (d == best && j < id)) {
+                best = d;
+                id = j;
+            }
+        }
+        float diff = Get(node, axis)-Get(List[j], axis);
+        if (diff < 0.0f) Find(node, before, best, id, lo, mid, (axis+1)%3);
+        else Find(node, before, best, id, mid+1, hi, (axis+1)%3);
+        if (diff*diff > best) return;
+        if (diff < 0.0f) Find(node, before, best, id, mid+1, hi, (axis+1)%3);
+        else Find(node, before, best, id, lo, mid, (axis+1)%3);
+    }
+    const std::vector<Node> &List;
+    std::vector<size_t> Order, Low;
+};
+
 size_t Tree::Reduce(size_t start, int lower)
 {
     if (_list.empty() || start >= _list.size()) return _list.size();
 
     static const float rs = 0.61803399f;
 
-    // connect all nodes into one tree
+    // connect all nodes into one tree, every root to its nearest earlier node,
+    // euclidean in [-1,1] where z is already scaled by the slice thickness
     if (_link) {
-        float r, minr;
+        KdTree index(_list);
+        float limit = 2.0f*_distance/_scale;
         for (size_t i=start; i<_list.size(); ++i) {
             if (_list[i].Pid > 0) continue;
-            minr = _scale;
-            for (size_t j=0; j<i; ++j) {
-                r = abs(_list[i].X-_list[j].X) + abs(_list[i].Y-_list[j].Y) + abs(_list[i].Z-_list[j].Z);
-                if (r < minr) { minr = r; _list[i].Pid = _list[j].Id; }
-            }
+            float best = (_distance > 0.0f) ? limit*limit : FLT_MAX;
+            size_t id = _list.size();
+            index.Find(_list[i], i, best, id);
+            if (id < _list.size()) _list[i].Pid = _list[id].Id;
         }
     }
 
@@ -370,46 +423,79 @@ size_t Tree::Reduce(size_t start, int lower)
         }
     } while (doing);
 
+    // children of every node in index order, as the forward scan for re-parenting met them
+    size_t n = _list.size();
+    std::vector<size_t> first(n+1, 0), kids;
+    for (size_t k=start; k<n; ++k)
+        if (_list[k].Pid > 0 && (size_t)_list[k].Pid <= n) ++first[_list[k].Pid];
+    for (size_t i=0; i<n; ++i) first[i+1] += first[i];
+    kids.resize(first[n]);
+    std::vector<size_t> fill(first.begin(), first.end()-1);
+    for (size_t k=start; k<n; ++k)
+        if (_list[k].Pid > 0 && (size_t)_list[k].Pid <= n) kids[fill[_list[k].Pid-1]++] = k;
+
+    // merged radii are averages, so no search reaches past 2*rs times the largest radius
+    float maxr = 0.0f;
+    for (size_t i=0; i<n; ++i) maxr = std::max(maxr, _list[i].Radius);
+    Grid<Node> grid(std::max(2.0f*rs*maxr, 2.0f/_scale));
+
     // copy optimal nodes to temporary list
     std::vector<Node> list;
-    for (size_t i=0; i<start; ++i) list.push_back(_list[i]);
+    for (size_t i=0; i<start; ++i) {
+        list.push_back(_list[i]);
+        grid.Insert(i, list[i]);
+    }
 
     // copy redundancy nodes to temporary list & merge overlap
-    bool repeat;
     float dr, dx, dy, dz;
-    for (size_t i=start; i<_list.size(); ++i) {
+    for (size_t i=start; i<n; ++i) {
         if (_list[i].Tag == -1) continue;
         if (_list[i].Tag == 1) {
             list.push_back(_list[i]);
+            grid.Insert(list.size()-1, list.back());
             continue;
         }
-        repeat = false;
-        for (size_t j=0; j<list.size(); ++j) {
-            dr = rs*(_list[i].Radius+list[j].Radius);
-            dx = abs(_list[i].X-list[j].X);
-            if (dx >= dr) continue;
-            dy = abs(_list[i].Y-list[j].Y);
-            if (dy >= dr) continue;
-            dz = abs(_list[i].Z-list[j].Z);
-            if (dz >= dr) continue;
-            if (dx*dx + dy*dy + dz*dz <= dr*dr) {
-                repeat = true;
-                list[j].X = (_list[i].X+list[j].X)/2.0f;
-                list[j].Y = (_list[i].Y+list[j].Y)/2.0f;
-                list[j].Z = (_list[i].Z+list[j].Z)/2.0f;
-                list[j].Radius = (_list[i].Radius+list[j].Radius)/2.0f;
-                for (size_t k=i+1; k<_list.size(); ++k) {
-                    if (_list[i].Child == 0) break;
-                    if (_list[k].Pid == _list[i].Id) {
-                        _list[k].Pid = list[j].Id;
-                        --_list[i].Child;
-                        ++list[j].Child;
-                    }
-                }
-                break;
+        // the first overlapping node in list order, as a linear scan would find
+        size_t j = list.size();
+        int x, y, z;
+        grid.GetCell(_list[i], x, y, z);
+        for (int c=0; c<27; ++c) {
+            const std::vector<size_t> *cell = grid.Find(x+c%3-1, y+c/3%3-1, z+c/9-1);
+            if (cell == 0) continue;
+            for (size_t m=0; m<cell->size(); ++m) {
+                size_t l = (*cell)[m];
+                if (l >= j) continue;
+                dr = rs*(_list[i].Radius+list[l].Radius);
+                dx = abs(_list[i].X-list[l].X);
+                if (dx >= dr) continue;
+                dy = abs(_list[i].Y-list[l].Y);
+                if (dy >= dr) continue;
+                dz = abs(_list[i].Z-list[l].Z);
+                if (dz >= dr) continue;
+                if (dx*dx + dy*dy + dz*dz <= dr*dr) j = l;
             }
         }
-        if (!repeat) list.push_back(_list[i]);
+        if (j == list.size()) {
+            list.push_back(_list[i]);
+            grid.Insert(j, list[j]);
+            continue;
+        }
+
+        grid.Remove(j, list[j]);
+        list[j].X = (_list[i].X+list[j].X)/2.0f;
+        list[j].Y = (_list[i].Y+list[j].Y)/2.0f;
+        list[j].Z = (_list[i].Z+list[j].Z)/2.0f;
+        list[j].Radius = (_list[i].Radius+list[j].Radius)/2.0f;
+        grid.Insert(j, list[j]);
+        if (_list[i].Id == 0 || _list[i].Id > n) continue;
+        for (size_t c=first[_list[i].Id-1]; c<first[_list[i].Id]; ++c) {
+            if (_list[i].Child == 0) break;
+            size_t k = kids[c];
+            if (k <= i) continue;
+            _list[k].Pid = list[j].Id;
+            --_list[i].Child;
+            ++list[j].Child;
+        }
     }
 
     // rearange nodes in temporary list
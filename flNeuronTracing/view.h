@@ -57,6 +57,8 @@ public:
     void SetProbing(Probing *probing) { _probing = probing; }
     void SetTracing(Tracing *tracing) { _tracing = tracing; }
     void SetMode(int mode) { _opmode = mode; if (_opmode > OP_TRACING) _opmode = OP_NONE; }
+    void LoadVolume(const char *path, const size_t *region=0); // region x0 y0 z0 x1 y1 z1 of TIFF
+    static void LoadThread(void *data) { ((View3D*)data)->ProcessLoad(); }
 
 protected:
     virtual void InitContext();
@@ -66,6 +68,7 @@ protected:
     virtual void EditObject(int winx, int winy);
     virtual void ProcessKey(int key);
     virtual void ProcessFresh();
+    void ProcessLoad();
 
 private:
     Volume *_volume;
@@ -76,6 +79,7 @@ private:
     Probing *_probing;
     Tracing *_tracing;
     int _opmode; // OP_MODE
+    char _path[256];
 };
 
 class View2D : public Fl_Gl_Window {
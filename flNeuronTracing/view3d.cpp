@@ -63,19 +63,8 @@ void View3D::ParsePaste(const char *text)
     strcpy(ext, fl_filename_ext(path));
     _strlwr(ext);
 
-    if (strcmp(ext, ".tif") == 0) {
-        char str[256];
-        sprintf(str, "flNeuronTool Tracing - loading %s ...", fl_filename_name(path));
-        window()->label(str);
-        _volume->Read(path);        
-        _volume->Show();
-        make_current();
-        _mapping->SetParam();
-        _probing->SetParam();
-        _tracing->SetParam();
-        redraw();
-        sprintf(str, "flNeuronTool Tracing - %s", fl_filename_name(path));
-        window()->label(str);
+    if (strcmp(ext, ".tif") == 0 || strcmp(ext, ".vol") == 0 || strcmp(ext, ".brk") == 0 || strcmp(ext, ".bkz") == 0) {
+        LoadVolume(path);
         return;
     }
 
@@ -101,12 +90,54 @@ void View3D::ParsePaste(const char *text)
         return;
     }
 
-    fl_alert("Unknown file type. \nSupport volume (TIFF), soma (APO), tree (SWC) file.\n");
+    fl_alert("Unknown file type. \nSupport volume (TIFF, VOL, BRK, BKZ), soma (APO), tree (SWC) file.\n");
+}
+
+void View3D::LoadVolume(const char *path, const size_t *region)
+{
+    if (_volume->IsLoading()) {
+        fl_alert("Please wait for the volume loading to finish.\n");
+        return;
+    }
+
+    char str[256];
+    sprintf(str, "flNeuronTool Tracing - loading %s ...", fl_filename_name(path));
+    window()->label(str);
+    strcpy(_path, path);
+    make_current();
+    bool ok = (region != 0) ? _volume->Read(path, region[0], region[1], region[2], region[3], region[4], region[5]) : _volume->BeginRead(path);
+    if (!ok) {
+        window()->label("flNeuronTool Tracing");
+        return;
+    }
+
+    // slabs of a progressive read are uploaded by the load timer, parameters are set once it completes
+    if (_volume->IsLoading()) Fl::add_timeout(0.1, View3D::LoadThread, this);
+    else ProcessLoad();
+}
+
+void View3D::ProcessLoad()
+{
+    make_current();
+    if (_volume->IsLoading() && !_volume->UpdateRead()) {
+        redraw();
+        Fl::repeat_timeout(0.1, View3D::LoadThread, this);
+        return;
+    }
+
+    _volume->Show();
+    _mapping->SetParam();
+    _probing->SetParam();
+    _tracing->SetParam();
+    redraw();
+    char str[256];
+    sprintf(str, "flNeuronTool Tracing - %s", fl_filename_name(_path));
+    window()->label(str);
 }
 
 void View3D::SelectObject(int winx, int winy)
 {
-    if (!_volume->IsValid()) return;
+    if (!_volume->IsValid() || _volume->IsLoading()) return;
 
     int view[4];
     double proj[16], model[16], obj[3];
@@ -125,7 +156,7 @@ void View3D::SelectObject(int winx, int winy)
 
 void View3D::EditObject(int winx, int winy)
 {
-    if (!_volume->IsValid() || _opmode == OP_NONE) return;
+    if (!_volume->IsValid() || _volume->IsLoading() || _opmode == OP_NONE) return;
 
     make_current();
     int view[4];
@@ -1,7 +1,14 @@
 #pragma once
 
 #include <vector>
+#include <list>
 #include <map>
+#include <string>
+#include <algorithm>
+#include <stdio.h>
+#include <math.h>
+#include <float.h>
+#include <omp.h>
 
 struct IVision {
     virtual ~IVision() {}
@@ -16,53 +23,288 @@ struct Point { // [0,S]
     float X, Y, Z, Value;
 };
 
+class Bricks { // BRK, out-of-core volume paged in size^3 bricks by a LRU cache, optionally deflated per brick
+public:
+    Bricks();
+    ~Bricks();
+
+    bool Open(const char *path, size_t capacity);
+    void Close();
+    static bool Write(const char *path, const unsigned char *buffer, size_t width, size_t height, size_t depth, float thickness, size_t size=64, bool compress=false, const unsigned char *lut=0); // lut maps voxels on the way out
+
+    bool IsValid() const { return _file != 0; }
+    bool IsCompressed() const { return _compress; }
+    size_t GetWidth() const { return _width; }
+    size_t GetHeight() const { return _height; }
+    size_t GetDepth() const { return _depth; }
+    float GetThickness() const { return _thickness; }
+    size_t GetResident() const { return _list.size(); }
+    unsigned char GetVoxel(size_t x, size_t y, size_t z);
+    void GetCube(size_t x, size_t y, size_t z, unsigned char *cube); // 2^3 voxels from x y z in x, y, z order, 0 outside, one lock for all
+    void GetRegion(unsigned char *region, size_t x0, size_t y0, size_t z0, size_t x1, size_t y1, size_t z1);
+    void Prefetch(size_t x0, size_t y0, size_t z0, size_t x1, size_t y1, size_t z1);
+    void GetSample(unsigned char *sample, size_t level);
+
+private:
+    const unsigned char *Load(size_t id); // lock held by caller
+    void Fetch(size_t id, unsigned char *brick); // lock held by caller
+
+    FILE *_file;
+    size_t _width, _height, _depth;
+    float _thickness;
+    size_t _size, _nx, _ny, _nz, _capacity;
+    bool _compress;
+    std::vector<unsigned long long> _index; // compressed bricks file offsets, count+1
+    std::vector<unsigned char> _packed;
+    std::vector<unsigned char*> _table; // resident bricks data by id, 0 if paged out
+    std::vector<std::list<size_t>::iterator> _where;
+    std::list<size_t> _list; // resident bricks ids, most recently used first
+    omp_lock_t _lock;
+};
+
+class Volume;
+
+enum VOX_LAYOUT { VOX_LINEAR, VOX_BRICK };
+
+class Sampler { // trilinear voxel sampler of a row major buffer with precomputed strides, optionally of a 8^3 bricks copy
+public:
+    Sampler() : _volume(0), _buffer(0), _width(0), _height(0), _depth(0), _sy(0), _sz(0), _size(0), _xmax(0.0f), _ymax(0.0f), _zmax(0.0f), _layout(VOX_LINEAR), _bsy(0), _bsz(0), _mapped(false) {}
+
+    void Reset(const Volume *volume, const unsigned char *buffer, size_t width, size_t height, size_t depth, int layout=VOX_LINEAR);
+    void Update(size_t x0, size_t y0, size_t z0, size_t x1, size_t y1, size_t z1); // buffer region changed, refresh bricks copy
+    void SetMapping(const unsigned char *lut); // 256 entries applied to the corners before blending, 0 for none
+    int GetLayout() const { return _layout; }
+    float GetVoxel(float x, float y, float z) const;
+    float GetVoxelRef(float x, float y, float z) const; // bounds checked reference
+    void GetVoxels(const float *xyz, float *out, size_t n) const; // n points of x y z, SIMD when available
+    void GetVoxelsRef(const float *xyz, float *out, size_t n) const;
+
+private:
+    size_t GetVoxelsAVX2(const float *xyz, float *out, size_t n) const; // x86 only, returns the points done, whole groups of 8
+
+    // bricks copy address is separable, x y z parts are summed
+    size_t GetOffsetX(size_t x) const { return ((x>>3)<<9) | (x&7); }
+    size_t GetOffsetY(size_t y) const { return (y>>3)*_bsy + ((y&7)<<3); }
+    size_t GetOffsetZ(size_t z) const { return (z>>3)*_bsz + ((z&7)<<6); }
+
+    const Volume *_volume; // fallback for borders & out-of-core bricks
+    const unsigned char *_buffer;
+    size_t _width, _height, _depth, _sy, _sz, _size;
+    float _xmax, _ymax, _zmax; // interior limits, all 8 neighbours inside below
+    int _layout; // VOX_LAYOUT
+    std::vector<unsigned char> _bricks; // 8^3 bricks in z, y, x brick order, padded with 0
+    size_t _bsy, _bsz; // bytes of a brick row & a brick layer
+    bool _mapped;
+    unsigned char _lut[260]; // 4 spare bytes for 32 bits gathers of the last entry
+};
+
+class Rays { // front of rays marched in lockstep from one origin, a ray stops on its first voxel failing the predicate
+public:
+    Rays() : _x0(0.0f), _y0(0.0f), _z0(0.0f), _value0(0.0f), _low(0.0f), _high(256.0f), _grads(255.0f), _limit(FLT_MAX) {}
+
+    void SetOrigin(float x, float y, float z, float value) { _x0 = x; _y0 = y; _z0 = z; _value0 = value; }
+    void SetStop(float low, float high, float grads, float limit) { _low = low; _high = high; _grads = grads; _limit = limit; } // go on while radius <= limit && (value >= high || value >= low && |value-value0| <= grads), high over 255 is off
+    void Clear() { _i.clear(); _j.clear(); _k.clear(); }
+    void AddRay(float i, float j, float k) { _i.push_back(i); _j.push_back(j); _k.push_back(k); }
+    void Cast(const Sampler &sampler, float radius, float step); // all rays start at radius, a ray keeps its last voxel passing the predicate
+    size_t GetSize() const { return _i.size(); }
+    float GetX(size_t i) const { return _x[i]; }
+    float GetY(size_t i) const { return _y[i]; }
+    float GetZ(size_t i) const { return _z[i]; }
+    float GetValue(size_t i) const { return _value[i]; }
+    float GetRadius(size_t i) const { return _radius[i]; }
+
+private:
+    float _x0, _y0, _z0, _value0, _low, _high, _grads, _limit;
+    std::vector<float> _i, _j, _k; // directions
+    std::vector<float> _x, _y, _z, _value, _radius; // results
+    std::vector<float> _xyz, _sample; // packed points & values of live rays
+    std::vector<size_t> _live;
+    std::vector<unsigned char> _pass;
+};
+
+class Occupancy { // sparse bit per voxel of traced tubes, 32^3 voxels bricks allocated on first stamp, thread safe
+public:
+    Occupancy();
+    ~Occupancy();
+
+    void Reset(size_t width, size_t height, size_t depth, float thickness=1.0f);
+    size_t GetResident() const; // bricks allocated
+    bool IsOccupied(float x, float y, float z) const; // by any tube
+    bool IsOccupied(float x, float y, float z, unsigned long long order, unsigned depth) const; // by tubes stamped before order, depth breaks ties
+    void Stamp(const Point &a, const Point &b, float radius) { Stamp(a, b, radius, 0, 0); } // capsule from a to b, radius in x y voxels
+    void Stamp(const Point &a, const Point &b, float radius, unsigned long long order, unsigned depth);
+
+private:
+    static const int locks = 64;
+    struct Tube { Point A, B; float Radius; unsigned long long Order; unsigned Depth; };
+
+    size_t _width, _height, _depth;
+    float _thickness;
+    size_t _nx, _ny, _nz;
+    std::vector<unsigned int*> _bricks; // 1024 words of bits each, 0 until stamped, bits set by atomic ORs & read by atomic loads
+    std::vector<std::vector<Tube> > _tubes; // stamps touching each brick, for ordered lookups
+    mutable omp_lock_t _locks[locks]; // striped over bricks, guard their allocation & tubes
+
+    Occupancy(const Occupancy&);
+    Occupancy &operator=(const Occupancy&);
+};
+
+enum REMAP_LEVEL { REMAP_SCALAR, REMAP_SSE41, REMAP_AVX2 };
+
+class Remap { // voxel remapping kernels over rows, the widest the CPU runs is picked at first use
+public:
+    static int GetLevel(); // REMAP_LEVEL
+    static int SetLevel(int level); // down to scalar for comparisons, never above the CPU
+    static const char *GetName();
+    static void Lut(unsigned char *row, size_t n, size_t rows, size_t stride, const unsigned char *lut); // rows of n voxels, stride apart
+    static void Window(unsigned char *row, size_t n, size_t rows, size_t stride, int low, int high); // clamp to [low,high] & scale to [0,255]
+    static void Benchmark(size_t size=(size_t)1<<28); // GB/s of the kernels & of per voxel loops
+};
+
+enum PRE_STEP { PRE_GAUSSIAN, PRE_MEDIAN, PRE_TOPHAT };
+
+class Preprocess { // chain of 3D filters run before tracing, separable passes over 64 columns tiles, parallel
+public:
+    void Clear() { _steps.clear(); }
+    void AddStep(int type, float size) { Step step = { type, size }; _steps.push_back(step); } // PRE_STEP, sigma or radius in x y voxels
+    bool SetChain(const char *text); // "g1.5 m1 t12", false on unknown steps
+    bool IsEmpty() const { return _steps.empty(); }
+    void Run(const unsigned char *src, unsigned char *dst, size_t width, size_t height, size_t depth, float thickness=1.0f) const; // dst may be src
+    static void Gaussian(unsigned char *buffer, size_t width, size_t height, size_t depth, float sigma, float thickness=1.0f);
+    static void Median(unsigned char *buffer, size_t width, size_t height, size_t depth, float radius, float thickness=1.0f); // separable median
+    static void TopHat(unsigned char *buffer, size_t width, size_t height, size_t depth, float radius, float thickness=1.0f); // minus the opening by a cuboid
+
+private:
+    struct Step {
+        int Type;
+        float Size;
+    };
+    std::vector<Step> _steps;
+};
+
 enum VOL_STYLE { VOL_NONE, VOL_MIP, VOL_ACCUM, VOL_BLEND };
+enum NORM_MODE { NORM_PERCENTILE, NORM_HISTOGRAM };
+enum TIF_CODEC { TIF_NONE, TIF_PACKBITS, TIF_LZW, TIF_DEFLATE };
 
 class Volume : public IVision { // TIFF
 public:
-    Volume() : _buffer(0), _width(0), _height(0), _depth(0), _thickness(1.0f), _scale(1.0f), _mean(0.0f), _low(0.0f), _high(0.0), _texture(0), _color(0), _program(0), _bound(true), _style(VOL_MIP) {}
+    Volume() : _buffer(0), _map(0), _length(0), _bricks(0), _sample(0), _level(1), _width(0), _height(0), _depth(0), _offx(0), _offy(0), _offz(0), _thickness(1.0f), _scale(1.0f), _mean(0.0f), _low(0.0f), _high(0.0), _edited(false), _fx(0), _fy(0), _fz(0), _loaded(0), _uploaded(0), _loading(false), _cancel(false), _pending(false), _texture(0), _color(0), _program(0), _bound(true), _style(VOL_MIP), _codec(TIF_PACKBITS), _layout(VOX_LINEAR) {}
     ~Volume();
 
     bool Read(const char *path);
+    bool Read(const char *path, size_t x0, size_t y0, size_t z0, size_t x1, size_t y1, size_t z1); // TIFF region
     bool Write(const char *path) const;
     void Draw() const;
     void Show() const;
+    bool BeginRead(const char *path); // progressive TIFF read on a background thread
+    bool UpdateRead(); // true once the progressive read completes
 
-    bool IsValid() const { return _buffer != 0; }
+    bool IsValid() const { return _buffer != 0 || _bricks != 0; }
+    bool IsBricked() const { return _bricks != 0; }
+    bool IsLoading() const { return _pending; }
     size_t GetWidth() const { return _width; }
     size_t GetHeight() const { return _height; }
     size_t GetDepth() const { return _depth; }
     float GetThickness() const { return _thickness; }
     float GetScale() const { return _scale; }
-    void SetThickness(float thickness=1.0f) { _thickness = thickness; _scale = std::max(std::max(_width, _height)*1.0f, _depth*_thickness); }
+    size_t GetOffsetX() const { return _offx; }
+    size_t GetOffsetY() const { return _offy; }
+    size_t GetOffsetZ() const { return _offz; }
+    void SetThickness(float thickness=1.0f);
     bool GetBound() const { return _bound; }
     bool SetBound(bool b) { _bound = b; return _bound; }
     int GetStyle() const { return _style; }
     int SetStyle(int style) { _style = style; if (_style > VOL_BLEND) _style = VOL_NONE; return _style; }
-    void SetSample(int level) const;
+    int GetCodec() const { return _codec; }
+    int SetCodec(int codec) { _codec = codec; if (_codec > TIF_DEFLATE) _codec = TIF_NONE; return _codec; }
+    int GetLayout() const { return _layout; }
+    int SetLayout(int layout); // sampler layout of volumes loaded later, applied to the current one too
+    void SetSample(int level);
+    size_t GetLevels() const { return _levels.size()+1; }
+    const unsigned char *GetLevel(size_t level, size_t &width, size_t &height, size_t &depth); // 0 is full resolution, edited voxels are reduced first
+    bool WritePyramid(); // as <volume file>.pyr, reused by later reads of the same file, refused once voxels are edited
     void SetColor(const unsigned char *color) const;
-    unsigned char GetVoxel(size_t x, size_t y, size_t z) const { return (_buffer==0 || x>=_width || y>=_height || z>=_depth) ? 0 : _buffer[z*_height*_width+y*_width+x]; }
-    float GetVoxel(float x, float y, float z) const;
+    unsigned char GetVoxel(size_t x, size_t y, size_t z) const { if (x>=_width || y>=_height || z>=_depth) return 0; unsigned char v = (_buffer!=0) ? _buffer[z*_height*_width+y*_width+x] : (_bricks!=0) ? _bricks->GetVoxel(x, y, z) : 0; return _lut.empty() ? v : _lut[v]; }
+    void GetCube(size_t x, size_t y, size_t z, unsigned char *cube) const; // trilinear corners, mapped, bricks resolved once
+    float GetVoxel(float x, float y, float z) const { return _sampler.GetVoxel(x, y, z); }
     float GetVoxel(Point &point) const { return GetVoxel(point.X, point.Y, point.Z); }
+    const Sampler &GetSampler() const { return _sampler; }
     Point GetPoint(float x, float y, float z) const; // [-1,1] -> [0,S]
     Point GetPoint(const Point &point0, const Point &point1) const;
+    void Prefetch(const Point &point, float i, float j, float k, float dist) const;
     void GetValue(float &mean, float &low, float &high, size_t x, size_t y, size_t z, size_t radius) const;
     void GetValue(float &mean, float &low, float &high) const { mean = _mean; low = _low; high = _high; }
+    bool GetLocalValue(float &mean, float &low, float &high, float x, float y, float z) const; // interpolated threshold field, false if not built
     void SetValue(int low, int high, size_t x, size_t y, size_t z, size_t radius);
     void SetValue(int low, int high);
     void GetIndex(double *index, size_t x, size_t y, size_t, size_t radius) const;
     void GetIndex(double *index) const { GetIndex(index, 0, 0, 0, (size_t)(_scale+0.5f)); }
     void SetValue(const unsigned char *value, size_t x, size_t y, size_t z, size_t radius);
     void SetValue(const unsigned char *value);
+    void SetMapping(const unsigned char *value); // compose a LUT over the raw voxels without touching them, 0 to drop it
+    bool IsMapped() const { return !_lut.empty(); }
+    void Bake(); // write the pending mapping into the voxels
+    void Filter(const Preprocess &chain); // in place on an in-memory volume, statistics, sampler, texture & pyramid follow
+    void Normalize(int mode, size_t slab=1, float low=0.01f, float high=0.99f); // NORM_MODE, match slab windows of slices to the whole volume
+
+private:
+    static bool IsType(const char *path, const char *ext);
+    bool ReadTIFF(const char *path, size_t x0=0, size_t y0=0, size_t z0=0, size_t x1=(size_t)-1, size_t y1=(size_t)-1, size_t z1=(size_t)-1);
+    void Prepare(); // pyramid from <_path>.pyr when saved for this file, built otherwise
+    static void ReadThread(void *data);
+    void InitContext();
+    bool ReadRaw(const char *path);
+    bool ReadBrick(const char *path);
+    bool WriteTIFF(const char *path) const;
+    bool WriteRaw(const char *path) const;
+    void Release();
+    void BuildPyramid();
+    void ClearPyramid();
+    void UpdatePyramid(); // reduce the voxels edited since the pyramid was built into every level
+    void BuildBlocks(); // per block histograms & threshold field of an in-memory volume
+    void UpdateValue(); // whole volume statistics from the histogram, through the mapping
+    void Refresh(); // voxels changed everywhere, rebuild what derives from them
+    void GetRawIndex(double *index, size_t x, size_t y, size_t z, size_t radius) const;
+    void Apply(const unsigned char *value, int low, int high, size_t x, size_t y, size_t z, size_t radius); // remap a box, by the window kernel when low >= 0
+    bool ReadPyramid();
+    const unsigned char *GetRegion(size_t &x0, size_t &y0, size_t &z0, size_t &x1, size_t &y1, size_t &z1, size_t &width, size_t &height, unsigned char *&region) const;
 
 private:
-    unsigned char *_buffer;
+    struct Level { // pyramid level reduced by scale in x & y, by scalez in z
+        unsigned char *Buffer;
+        size_t Width, Height, Depth, Scale, ScaleZ;
+    };
+
+    unsigned char *_buffer, *_map; // _map is the raw file mapping when _buffer points into it
+    size_t _length;
+    Bricks *_bricks; // out-of-core bricks when _buffer is 0
+    unsigned char *_sample; // downsampled maximum of bricks for texture & statistics
+    size_t _level;
+    std::vector<Level> _levels; // pyramid levels 1.., level 0 is _buffer
+    std::vector<size_t> _dirty; // x0 y0 z0 x1 y1 z1 of voxels edited since the pyramid was updated, empty if none
+    Sampler _sampler;
     size_t _width, _height, _depth;
+    size_t _offx, _offy, _offz; // region origin in the full TIFF stack
     float _thickness, _scale;
     float _mean, _low, _high;
+    std::string _path; // volume file, empty for a region
+    bool _edited; // voxels changed since read, the file stamp no longer vouches for a pyramid of them
+    std::vector<unsigned long long> _offsets;
+    std::vector<double> _histogram;
+    std::vector<unsigned short> _blocks; // 256 bins histogram of each 32^3 block
+    std::vector<float> _field; // mean, low & high of each 32^3 block, of mapped values
+    std::vector<unsigned char> _lut; // pending mapping of raw voxels, empty for none
+    size_t _fx, _fy, _fz;
+    volatile size_t _loaded;
+    size_t _uploaded;
+    volatile bool _loading, _cancel;
+    bool _pending;
     unsigned _texture, _color, _program;
     bool _bound;
     int _style; // VOL_STYLE
+    int _codec; // TIF_CODEC of written TIFF
+    int _layout; // VOX_LAYOUT of the sampler
 };
 
 enum LUT_STYLE { LUT_NONE, LUT_BOUND, LUT_LINE };
@@ -98,6 +340,34 @@ private:
     int _style; // LUT_STYLE
 };
 
+template <class T>
+struct Grid { // uniform grid of list indices of nodes or cells by position, anything within the cell size of a position sits in the 27 cells around
+    Grid(float size) : Size(size) {}
+    void GetCell(const T &item, int &x, int &y, int &z) const {
+        x = (int)floor(item.X/Size);
+        y = (int)floor(item.Y/Size);
+        z = (int)floor(item.Z/Size);
+    }
+    static long long GetKey(int x, int y, int z) { return (((long long)(x+(1<<20)) << 42) | ((long long)(y+(1<<20)) << 21)) | (long long)(z+(1<<20)); }
+    const std::vector<size_t> *Find(int x, int y, int z) const {
+        typename std::map<long long, std::vector<size_t> >::const_iterator it = Cells.find(GetKey(x, y, z));
+        return (it != Cells.end()) ? &it->second : 0;
+    }
+    void Insert(size_t id, const T &item) {
+        int x, y, z;
+        GetCell(item, x, y, z);
+        Cells[GetKey(x, y, z)].push_back(id);
+    }
+    void Remove(size_t id, const T &item) {
+        int x, y, z;
+        GetCell(item, x, y, z);
+        std::vector<size_t> &cell = Cells[GetKey(x, y, z)];
+        cell.erase(std::find(cell.begin(), cell.end(), id));
+    }
+    float Size;
+    std::map<long long, std::vector<size_t> > Cells;
+};
+
 struct Cell { // [-1,1]
     Cell() : X(0.0f), Y(0.0f), Z(0.0f), Radius(0.0f), Value(0.0f) {}
     float X, Y, Z, Radius, Value;
@@ -113,7 +383,7 @@ enum APO_STYLE { APO_NONE, APO_POINT, APO_WIRE, APO_SOLID };
 
 class Soma : public IVision { // APO
 public:
-    Soma() : _list(0), _width(0), _height(0), _depth(0), _thickness(1.0f), _scale(1.0f), _style(APO_POINT), _merge(false) {}
+    Soma() : _list(0), _width(0), _height(0), _depth(0), _thickness(1.0f), _scale(1.0f), _offx(0), _offy(0), _offz(0), _style(APO_POINT), _merge(false) {}
     ~Soma() {}
 
     bool Read(const char *path);
@@ -123,6 +393,7 @@ public:
 
     bool IsValid() const { return !_list.empty(); }
     void SetExtent(size_t width, size_t height, size_t depth, float thickness=1.0f);
+    void SetOffset(size_t x, size_t y, size_t z) { _offx = x; _offy = y; _offz = z; } // volume origin in the full dataset, applied on read & write
     int GetStyle() const  { return _style; }
     int SetStyle(int style) { _style = style; if (_style > APO_SOLID) _style = APO_NONE; return _style; }
     bool GetMerge() const { return _merge; }
@@ -134,13 +405,14 @@ public:
     size_t AddPoint(const PCell &point); // [0,S] -> [-1,1]
     size_t Remove() { if (!_list.empty()) _list.pop_back(); return _list.size(); }
     void Clear() { _list.clear(); }
-    size_t Reduce(size_t start=0);
+    size_t Reduce(size_t start=0, bool parallel=false); // parallel by space slabs, the result then does not depend on the cells order
     size_t PruneSmall(float radius);
 
 private:
     std::vector<Cell> _list;
     size_t _width, _height, _depth;
     float _thickness, _scale;
+    size_t _offx, _offy, _offz;
     int _style; // APO_STYLE
     bool _merge;
 };
@@ -165,8 +437,8 @@ enum SWC_STYLE { SWC_NONE, SWC_LINE, SWC_STRIP, SWC_DISK, SWC_BALL, SWC_WIRE, SW
 
 class Tree : public IVision { // SWC
 public:
-    Tree() : _list(0), _width(0), _height(0), _depth(0), _thickness(1.0f), _scale(1.0f), _style(SWC_LINE), _link(false) {}
-    ~Tree() {}
+    Tree() : _list(0), _width(0), _height(0), _depth(0), _thickness(1.0f), _scale(1.0f), _offx(0), _offy(0), _offz(0), _style(SWC_LINE), _link(false), _distance(0.0f) { omp_init_lock(&_lock); }
+    ~Tree() { omp_destroy_lock(&_lock); }
 
     bool Read(const char *path);
     bool Write(const char *path) const;
@@ -175,15 +447,18 @@ public:
 
     bool IsValid() const { return !_list.empty(); }
     void SetExtent(size_t width, size_t height, size_t depth, float thickness=1.0f);
+    void SetOffset(size_t x, size_t y, size_t z) { _offx = x; _offy = y; _offz = z; } // volume origin in the full dataset, applied on read & write
     int GetStyle() const { return _style; }
     int SetStyle(int style) { _style = style; if (_style > SWC_SOLID) _style = SWC_NONE; return _style; }
     bool GetLink() const { return _link; }
     bool SetLink(bool b) { _link = b; return _link; }
+    float GetLinkDistance() const { return _distance; }
+    float SetLinkDistance(float distance) { _distance = (distance > 0.0f) ? distance : 0.0f; return _distance; } // gaps linked by Reduce in voxels, 0 for any
     size_t GetSize() const { return _list.size(); }
     Node GetNode(size_t id) const { return (id < _list.size()) ? _list[id] : Node(); }
     PNode GetPoint(size_t id) const; // [-1,1] -> [0,S]
     size_t AddNode(const Node &node) { _list.push_back(node); return node.Id; }
-    size_t AddPoint(const PNode &point); // [0,S] -> [-1,1]
+    size_t AddPoint(const PNode &point); // [0,S] -> [-1,1], thread safe, ids are handed out in call order
     size_t Remove() { if (!_list.empty()) _list.pop_back(); return _list.size(); }
     void Clear() { _list.clear(); }
     size_t Reduce(size_t start=0, int lower=1);
@@ -194,6 +469,9 @@ private:
     std::vector<Node> _list;
     size_t _width, _height, _depth;
     float _thickness, _scale;
+    size_t _offx, _offy, _offz;
     int _style; // SWC_STYLE
     bool _link;
+    float _distance;
+    omp_lock_t _lock; // AddPoint from tracing threads
 };
@@ -2,15 +2,32 @@
 
 #include <stdio.h>
 #include <math.h>
+#include <ctype.h>
 #include <time.h>
+#include <string.h>
+#include <string>
 #include <omp.h>
+#include <process.h>
 #include <GL/glew.h>
 #include <glm/glm.hpp>
 #include <tiffio.h>
+#include <zlib.h>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 Volume::~Volume()
 {
-    if (_buffer != 0) delete[] _buffer;
+    Release();
     if (glIsTexture(_texture)) glDeleteTextures(1, &_texture);
     if (glIsTexture(_color)) glDeleteTextures(1, &_color);
     if (glIsProgram(_program)) glDeleteProgram(_program);
@@ -18,8 +35,80 @@ Volume::~Volume()
     _texture = _color = _program = 0;
 }
 
-bool Volume::Read(const char *path)
-{   
+// decode [x0,x0+w)*[y0,y0+h) of current 8 bits gray directory by strips or tiles into slice, return false for RGBA fallback
+static bool ReadSlice(TIFF *tif, uint8 *slice, uint32 width, uint32 height, uint32 x0, uint32 y0, uint32 w, uint32 h)
+{
+    uint16 photo=1, channels=1, bits=8, planar=PLANARCONFIG_CONTIG, orient=ORIENTATION_TOPLEFT;
+    uint32 iw=0, ih=0;
+    TIFFGetField(tif, TIFFTAG_PHOTOMETRIC, &photo);
+    TIFFGetFieldDefaulted(tif, TIFFTAG_SAMPLESPERPIXEL, &channels);
+    TIFFGetFieldDefaulted(tif, TIFFTAG_BITSPERSAMPLE, &bits);
+    TIFFGetFieldDefaulted(tif, TIFFTAG_PLANARCONFIG, &planar);
+    TIFFGetFieldDefaulted(tif, TIFFTAG_ORIENTATION, &orient);
+    TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &iw);
+    TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &ih);
+    if (photo > PHOTOMETRIC_MINISBLACK || channels != 1 || bits != 8 || planar != PLANARCONFIG_CONTIG) return false;
+    if (orient != ORIENTATION_TOPLEFT || iw != width || ih != height) return false;
+
+    uint32 x1 = x0+w, y1 = y0+h;
+    if (TIFFIsTiled(tif)) {
+        // only tiles overlapping the region are decoded
+        uint32 tw=0, th=0;
+        TIFFGetField(tif, TIFFTAG_TILEWIDTH, &tw);
+        TIFFGetField(tif, TIFFTAG_TILELENGTH, &th);
+        if (tw == 0 || th == 0) return false;
+        uint8 *tile = new uint8[TIFFTileSize(tif)];
+        for (uint32 y=y0/th*th; y<y1; y+=th) {
+            for (uint32 x=x0/tw*tw; x<x1; x+=tw) {
+                if (TIFFReadEncodedTile(tif, TIFFComputeTile(tif, x, y, 0, 0), tile, TIFFTileSize(tif)) < 0) {
+                    delete[] tile;
+                    return false;
+                }
+                uint32 sy = std::max(y, y0), ey = std::min(y+th, y1);
+                uint32 sx = std::max(x, x0), ex = std::min(x+tw, x1);
+                for (uint32 j=sy; j<ey; ++j)
+                    memcpy(slice+(size_t)(j-y0)*w+sx-x0, tile+(size_t)(j-y)*tw+sx-x, ex-sx);
+            }
+        }
+        delete[] tile;
+    }
+    else {
+        // only strips overlapping the region are decoded, full width strips inside it in place
+        uint32 rps = height;
+        TIFFGetFieldDefaulted(tif, TIFFTAG_ROWSPERSTRIP, &rps);
+        if (rps == 0 || rps > height) rps = height;
+        uint32 strips = TIFFNumberOfStrips(tif);
+        uint8 *strip = 0;
+        for (uint32 s=y0/rps; s<strips && s*rps<y1; ++s) {
+            uint32 rows = (s*rps+rps>height) ? (height-s*rps) : rps;
+            if (x0 == 0 && w == width && s*rps >= y0 && s*rps+rows <= y1) {
+                if (TIFFReadEncodedStrip(tif, s, slice+(size_t)(s*rps-y0)*width, (tmsize_t)rows*width) < 0) {
+                    if (strip != 0) delete[] strip;
+                    return false;
+                }
+                continue;
+            }
+            if (strip == 0) strip = new uint8[(size_t)rps*width];
+            if (TIFFReadEncodedStrip(tif, s, strip, (tmsize_t)rows*width) < 0) {
+                delete[] strip;
+                return false;
+            }
+            uint32 sy = std::max(s*rps, y0), ey = std::min(s*rps+rows, y1);
+            for (uint32 j=sy; j<ey; ++j)
+                memcpy(slice+(size_t)(j-y0)*w, strip+(size_t)(j-s*rps)*width+x0, w);
+        }
+        if (strip != 0) delete[] strip;
+    }
+
+    if (photo == PHOTOMETRIC_MINISWHITE) {
+        for (size_t j=0; j<(size_t)w*h; ++j) slice[j] = 255-slice[j];
+    }
+    return true;
+}
+
+// validate first directory & index directory offsets, slices are decoded concurrently later
+static bool IndexTIFF(const char *path, uint32 &width, uint32 &height, std::vector<unsigned long long> &offsets, size_t limit=(size_t)-1)
+{
     TIFFSetWarningHandler(0);
     TIFF *tif = TIFFOpen(path, "rb");
     if (tif == 0) {
@@ -37,36 +126,279 @@ bool Volume::Read(const char *path)
         return false;
     }
 
-    uint32 width=0, height=0;
+    width = height = 0;
     TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &width);
     TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &height);
-    uint16 depth = TIFFNumberOfDirectories(tif);
-    uint8 *buffer = new uint8[width*height*depth];
-    uint32 *slice = new uint32[width*height]; 
-    for (uint16 i=0; i<depth; ++i) {
-        // assert bits, channels, photometric & width, height
-        TIFFReadRGBAImageOriented(tif, width, height, slice, ORIENTATION_TOPLEFT);
-        for (uint32 j=0; j<width*height; ++j)
-            buffer[i*width*height+j] = TIFFGetR(slice[j]);
-        TIFFReadDirectory(tif);
-    }
-    delete[] slice;
+
+    // count directories by walking the chain, TIFFNumberOfDirectories may be 16 bits, stop after limit
+    offsets.clear();
+    do offsets.push_back(TIFFCurrentDirOffset(tif)); while (offsets.size() < limit && TIFFReadDirectory(tif));
     TIFFClose(tif);
-    printf("[Volume::Read] read TIFF file %s ok\n", path);
+    return true;
+}
+
+// one TIFF handle per OpenMP thread, opened on first use & kept for the whole read
+struct TIFFHandles {
+    std::string Path;
+    std::vector<TIFF*> Files;
+    TIFFHandles(const char *path) : Path(path), Files(omp_get_max_threads(), (TIFF*)0) {}
+    ~TIFFHandles() { for (size_t i=0; i<Files.size(); ++i) if (Files[i] != 0) TIFFClose(Files[i]); }
+    TIFF *Get() {
+        size_t id = (size_t)omp_get_thread_num();
+        if (id >= Files.size()) return 0;
+        if (Files[id] == 0) Files[id] = TIFFOpen(Path.c_str(), "rb");
+        return Files[id];
+    }
+};
+
+// decode region [x0,x0+w)*[y0,y0+h) of slices [begin,end) into buffer from slice begin-z0, return count of failed slices
+static int DecodeTIFF(TIFFHandles &files, const std::vector<unsigned long long> &offsets, uint8 *buffer, uint32 width, uint32 height,
+    size_t begin, size_t end, uint32 x0=0, uint32 y0=0, uint32 w=0, uint32 h=0, size_t z0=0)
+{
+    if (w == 0) w = width;
+    if (h == 0) h = height;
+    size_t size = (size_t)w*h;
+    int fails = 0;
+    #pragma omp parallel reduction(+:fails)
+    {
+        TIFF *tif = files.Get();
+        uint32 *slice = 0;
+        #pragma omp for schedule(dynamic)
+        for (int i=(int)begin; i<(int)end; ++i) {
+            uint8 *dst = buffer + (i-z0)*size;
+            if (tif == 0 || !TIFFSetSubDirectory(tif, (toff_t)offsets[i])) {
+                memset(dst, 0, size);
+                ++fails;
+                continue;
+            }
+            // assert bits, channels, photometric & width, height
+            if (!ReadSlice(tif, dst, width, height, x0, y0, w, h)) {
+                if (slice == 0) slice = new uint32[(size_t)width*height];
+                TIFFReadRGBAImageOriented(tif, width, height, slice, ORIENTATION_TOPLEFT);
+                for (size_t j=0; j<h; ++j)
+                    for (size_t k=0; k<w; ++k)
+                        dst[j*w+k] = TIFFGetR(slice[(y0+j)*width+x0+k]);
+            }
+        }
+        if (slice != 0) delete[] slice;
+    }
+    return fails;
+}
+
+// isodata threshold of a 256 bins histogram, low & high are the background & foreground means
+static void IsoData(const double *index, float &mean, float &low, float &high)
+{
+    double n = 0.0, sum = 0.0;
+    for (int v=0; v<256; ++v) {
+        n += index[v];
+        sum += index[v]*v;
+    }
+    double b = 0.0, f = 0.0, t0 = 0.0, t1 = (n > 0.0) ? sum/n : 0.0;
+    mean = (float)t1;
 
-    if (_buffer != 0) delete[] _buffer;
+    do {
+        double nb = 0.0, sb = 0.0;
+        t0 = t1;
+        for (int v=0; v<256 && v<t0; ++v) {
+            nb += index[v];
+            sb += index[v]*v;
+        }
+        b = (nb > 0.0) ? sb/nb : 0.0;
+        f = (n-nb > 0.0) ? (sum-sb)/(n-nb) : 0.0;
+        t1 = (b+f)/2.0;
+    } while (abs(t1-t0) > 0.5);
+    low = (float)b;
+    high = (float)f;
+}
+
+// edge of statistics blocks, per block histograms & threshold field
+static const size_t block = 32;
+
+// isodata of block bins, seen through a mapping when lut is not 0
+static void IsoData(const unsigned short *bins, const unsigned char *lut, float *field)
+{
+    double index[256];
+    memset(index, 0, 256*sizeof(double));
+    for (int v=0; v<256; ++v) index[(lut != 0) ? lut[v] : v] += bins[v];
+    IsoData(index, field[0], field[1], field[2]);
+}
+
+bool Volume::ReadTIFF(const char *path, size_t x0, size_t y0, size_t z0, size_t x1, size_t y1, size_t z1)
+{
+    // directories past the region are not walked
+    uint32 width, height;
+    std::vector<unsigned long long> offsets;
+    if (!IndexTIFF(path, width, height, offsets, (z1 == (size_t)-1) ? z1 : z1+1)) return false;
+    x1 = std::min(x1, (size_t)width-1);
+    y1 = std::min(y1, (size_t)height-1);
+    z1 = std::min(z1, offsets.size()-1);
+    if (width == 0 || height == 0 || x0 > x1 || y0 > y1 || z0 > z1) {
+        printf("[Volume::Read] TIFF region is outside of %d x %d x %d stack\n", (int)width, (int)height, (int)offsets.size());
+        return false;
+    }
+    size_t w = x1-x0+1, h = y1-y0+1, depth = z1-z0+1;
+
+    // wall time, clock() sums the decoding threads
+    double t = omp_get_wtime();
+    uint8 *buffer = new uint8[w*h*depth];
+    TIFFHandles files(path);
+    int fails = DecodeTIFF(files, offsets, buffer, width, height, z0, z1+1, (uint32)x0, (uint32)y0, (uint32)w, (uint32)h, z0);
+    t = omp_get_wtime()-t;
+    if (fails > 0) printf("[Volume::Read] %d of %d slices failed to decode\n", fails, (int)depth);
+    printf("[Volume::Read] decode %d slices ok (%ld ms, %.1f slices/s)\n", (int)depth, (long)(t*1000.0), depth/(t>0.0 ? t : 1e-3));
+    if (w != width || h != height || depth != offsets.size())
+        printf("[Volume::Read] read TIFF file %s region %d %d %d, %d x %d x %d ok\n", path, (int)x0, (int)y0, (int)z0, (int)w, (int)h, (int)depth);
+    else printf("[Volume::Read] read TIFF file %s ok\n", path);
+
+    Release();
     _buffer = buffer;
-    _width = width;
-    _height = height;
+    _width = w;
+    _height = h;
     _depth = depth;
+    _offx = x0;
+    _offy = y0;
+    _offz = z0;
     _thickness = 1.0f;
+    return true;
+}
+
+bool Volume::Read(const char *path)
+{
+    bool ok = IsType(path, ".vol") ? ReadRaw(path) : (IsType(path, ".brk") || IsType(path, ".bkz")) ? ReadBrick(path) : ReadTIFF(path);
+    if (!ok) return false;
+
+    _path = path;
+    Prepare();
+    return true;
+}
+
+bool Volume::Read(const char *path, size_t x0, size_t y0, size_t z0, size_t x1, size_t y1, size_t z1)
+{
+    if (!ReadTIFF(path, x0, y0, z0, x1, y1, z1)) return false;
+
+    _path.clear(); // pyramid of a region is not saved
+    Prepare();
+    return true;
+}
+
+void Volume::Prepare()
+{
+    _sampler.Reset(this, _buffer, _width, _height, _depth, _layout);
     _scale = max(max(_width, _height)*1.0f, _depth*_thickness);
     if (_scale < 1.0f) _scale = 1.0f;
 
     clock_t t = clock();
-    GetValue(_mean, _low, _high, 0, 0, 0, (size_t)(_scale+0.5f));
+    double index[256];
+    _histogram.clear();
+    BuildBlocks();
+    GetRawIndex(index, 0, 0, 0, (size_t)(_scale+0.5f));
+    _histogram.assign(index, index+256);
+    UpdateValue();
     printf("[Volume::Read] calculate volume voxel values ok (%ld ms)\n", clock()-t);
 
+    // reuse pyramid saved next to the volume file, otherwise build it
+    if (_buffer != 0 && !ReadPyramid()) BuildPyramid();
+
+    InitContext();
+    glBindTexture(GL_TEXTURE_3D, _texture);
+    if (_bricks != 0) glTexImage3D(GL_TEXTURE_3D, 0, GL_INTENSITY, (_width+_level-1)/_level, (_height+_level-1)/_level, (_depth+_level-1)/_level, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, _sample);
+    else glTexImage3D(GL_TEXTURE_3D, 0, GL_INTENSITY, _width, _height, _depth, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, _buffer);
+}
+
+bool Volume::BeginRead(const char *path)
+{
+    // other formats are mapped or paged without decoding
+    if (!IsType(path, ".tif") && !IsType(path, ".tiff")) return Read(path);
+
+    uint32 width, height;
+    std::vector<unsigned long long> offsets;
+    if (!IndexTIFF(path, width, height, offsets)) return false;
+
+    uint8 *buffer = new uint8[(size_t)width*height*offsets.size()];
+    Release();
+    _buffer = buffer;
+    _width = width;
+    _height = height;
+    _depth = offsets.size();
+    _thickness = 1.0f;
+    _scale = max(max(_width, _height)*1.0f, _depth*_thickness);
+    if (_scale < 1.0f) _scale = 1.0f;
+    _mean = _low = _high = 0.0f;
+    _path = path;
+    _offsets.swap(offsets);
+    _sampler.Reset(this, _buffer, _width, _height, _depth);
+    _histogram.assign(256, 0.0);
+    _loaded = _uploaded = 0;
+    _cancel = false;
+    _loading = _pending = true;
+
+    // texture is allocated empty, slabs are filled in by UpdateRead as they are decoded
+    InitContext();
+    glBindTexture(GL_TEXTURE_3D, _texture);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_INTENSITY, _width, _height, _depth, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, 0);
+    _beginthread(Volume::ReadThread, 0, (void*)this);
+    return true;
+}
+
+void Volume::ReadThread(void *data)
+{
+    static const size_t slab = 16; // slices published per step
+
+    Volume *volume = (Volume*)data;
+    double t = omp_get_wtime();
+    int fails = 0;
+    {
+        TIFFHandles files(volume->_path.c_str()); // closed before the read is flagged done
+        for (size_t z=0; z<volume->_depth && !volume->_cancel; z+=slab) {
+            size_t end = min(z+slab, volume->_depth);
+            fails += DecodeTIFF(files, volume->_offsets, volume->_buffer, (uint32)volume->_width, (uint32)volume->_height, z, end);
+            volume->_loaded = end;
+        }
+    }
+    t = omp_get_wtime()-t;
+    if (fails > 0) printf("[Volume::ReadThread] %d of %d slices failed to decode\n", fails, (int)volume->_depth);
+    printf("[Volume::ReadThread] decode %d slices ok (%ld ms, %.1f slices/s)\n", (int)volume->_loaded, (long)(t*1000.0), volume->_loaded/(t>0.0 ? t : 1e-3));
+    volume->_loading = false;
+}
+
+bool Volume::UpdateRead()
+{
+    if (!_pending) return false;
+
+    // upload decoded slabs & fold them into the histogram, called with the GL context current
+    size_t loaded = _loaded, size = _width*_height;
+    if (loaded > _uploaded) {
+        glBindTexture(GL_TEXTURE_3D, _texture);
+        glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, _uploaded, _width, _height, loaded-_uploaded, GL_LUMINANCE, GL_UNSIGNED_BYTE, _buffer+_uploaded*size);
+        #pragma omp parallel
+        {
+            double index[256];
+            memset(index, 0, 256*sizeof(double));
+            #pragma omp for
+            for (int i=(int)_uploaded; i<(int)loaded; ++i) {
+                const unsigned char *slice = _buffer + i*size;
+                for (size_t j=0; j<size; ++j) index[slice[j]] += 1.0;
+            }
+            #pragma omp critical
+            for (int v=0; v<256; ++v) _histogram[v] += index[v];
+        }
+        UpdateValue();
+        _uploaded = loaded;
+    }
+    if (_uploaded < _depth) return false;
+
+    clock_t t = clock();
+    if (!ReadPyramid()) BuildPyramid();
+    BuildBlocks();
+    printf("[Volume::UpdateRead] read TIFF file %s ok (%ld ms)\n", _path.c_str(), clock()-t);
+    if (_layout != VOX_LINEAR) _sampler.Reset(this, _buffer, _width, _height, _depth, _layout); // bricks copy once all slices are in
+    _pending = false;
+    _offsets.clear();
+    return true;
+}
+
+void Volume::InitContext()
+{
     if (!glIsTexture(_texture)) {
         glGenTextures(1, &_texture);
         glBindTexture(GL_TEXTURE_3D, _texture);
@@ -86,8 +418,6 @@ bool Volume::Read(const char *path)
         glTexGeni(GL_R, GL_TEXTURE_GEN_MODE, GL_OBJECT_LINEAR);
         glTexGenfv(GL_R, GL_OBJECT_PLANE, zcoeff);
     }
-    glBindTexture(GL_TEXTURE_3D, _texture);
-    glTexImage3D(GL_TEXTURE_3D, 0, GL_INTENSITY, _width, _height, _depth, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, _buffer);
 
     unsigned char color[256];
     for (size_t i=0; i<256; ++i) color[i] = i;
@@ -113,33 +443,605 @@ bool Volume::Read(const char *path)
         glAttachShader(_program, fshader);
         glLinkProgram(_program);
     }
-    return true;
 }
 
 bool Volume::Write(const char *path) const
 {
     if (_buffer == 0) return false;
 
-    TIFF *tif = TIFFOpen(path, "wb");
-    if (tif == 0) {
-        printf("[Volume::Write] open TIFF file %s failed\n", path);
-        return false;
+    // a pending mapping is applied to copies on the way out, the buffer is never touched
+    const unsigned char *lut = _lut.empty() ? 0 : &_lut[0];
+    if (IsType(path, ".brk")) return Bricks::Write(path, _buffer, _width, _height, _depth, _thickness, 64, false, lut);
+    if (IsType(path, ".bkz")) return Bricks::Write(path, _buffer, _width, _height, _depth, _thickness, 64, true, lut);
+    return IsType(path, ".vol") ? WriteRaw(path) : WriteTIFF(path);
+}
+
+// PackBits runs & literals of each row separately, as TIFF requires
+static void EncodePackBits(const uint8 *src, uint32 width, uint32 rows, std::vector<uint8> &dst)
+{
+    dst.clear();
+    for (uint32 r=0; r<rows; ++r) {
+        const uint8 *row = src + (size_t)r*width;
+        uint32 i = 0;
+        while (i < width) {
+            uint32 run = 1;
+            while (i+run < width && run < 128 && row[i+run] == row[i]) ++run;
+            if (run >= 2) {
+                dst.push_back((uint8)(257-run));
+                dst.push_back(row[i]);
+                i += run;
+                continue;
+            }
+            uint32 n = 1;
+            while (i+n < width && n < 128 && !(i+n+1 < width && row[i+n] == row[i+n+1])) ++n;
+            dst.push_back((uint8)(n-1));
+            dst.insert(dst.end(), row+i, row+i+n);
+            i += n;
+        }
     }
+}
+
+// TIFF LZW, msb first codes of 9 to 12 bits with early change
+// table is prefix code & byte -> code, kept by the caller across strips & left all -1 on return
+static void EncodeLZW(const uint8 *src, size_t size, std::vector<uint8> &dst, std::vector<short> &table)
+{
+    static const int clear = 256, eoi = 257, first = 258, last = 4094;
+
+    dst.clear();
+    if (table.size() != 4096*256) table.assign(4096*256, -1);
+    std::vector<int> used;
+    unsigned long bits = 0;
+    int nbits = 9, count = 0, next = first, maxcode = 511;
+    #define PUT_CODE(c) { bits = (bits<<nbits) | (c); count += nbits; while (count >= 8) { count -= 8; dst.push_back((uint8)(bits>>count)); } }
+    PUT_CODE(clear);
+    if (size == 0) {
+        PUT_CODE(eoi);
+        if (count > 0) dst.push_back((uint8)(bits<<(8-count)));
+        return;
+    }
+    int ent = src[0];
+    for (size_t i=1; i<size; ++i) {
+        int key = ent*256 + src[i];
+        if (table[key] >= 0) {
+            ent = table[key];
+            continue;
+        }
+        PUT_CODE(ent);
+        ent = src[i];
+        table[key] = (short)next++;
+        used.push_back(key);
+        if (next == last) {
+            for (size_t j=0; j<used.size(); ++j) table[used[j]] = -1;
+            used.clear();
+            next = first;
+            PUT_CODE(clear);
+            nbits = 9;
+            maxcode = 511;
+        }
+        else if (next > maxcode) {
+            ++nbits;
+            maxcode = (1<<nbits)-1;
+        }
+    }
+    PUT_CODE(ent);
+    if (++next == last) {
+        PUT_CODE(clear);
+        nbits = 9;
+    }
+    else if (next > maxcode) ++nbits;
+    PUT_CODE(eoi);
+    #undef PUT_CODE
+    if (count > 0) dst.push_back((uint8)(bits<<(8-count)));
+    for (size_t j=0; j<used.size(); ++j) table[used[j]] = -1;
+}
+
+// encode one strip of rows by the TIF_CODEC, table is the LZW dictionary of the calling thread
+static void EncodeStrip(int codec, const uint8 *src, uint32 width, uint32 rows, std::vector<uint8> &dst, std::vector<short> &table)
+{
+    size_t size = (size_t)width*rows;
+    if (codec == TIF_PACKBITS) EncodePackBits(src, width, rows, dst);
+    else if (codec == TIF_LZW) EncodeLZW(src, size, dst, table);
+    else if (codec == TIF_DEFLATE) {
+        uLongf length = compressBound((uLong)size);
+        dst.resize(length);
+        if (compress2(&dst[0], &length, src, (uLong)size, Z_BEST_SPEED) != Z_OK) length = 0;
+        dst.resize(length);
+    }
+    else dst.assign(src, src+size);
+}
+
+// worst encoded bytes of a strip of n voxels in rows rows: PackBits 4 bytes per 1 literal & a run of 2,
+// LZW 12 bits codes & its clear codes, the zlib bound for Deflate
+static size_t GetEncodedBound(int codec, size_t n, size_t rows)
+{
+    if (codec == TIF_PACKBITS) return n + (n+2)/3 + 2*rows;
+    if (codec == TIF_LZW) return n*3/2 + n/1024 + 8;
+    if (codec == TIF_DEFLATE) return n + (n>>12) + (n>>14) + (n>>25) + 13;
+    return n;
+}
+
+// write encoded strips of slices as directories in order
+static bool WriteStrips(TIFF *tif, std::vector<std::vector<uint8> > &strips, size_t slices, uint32 width, uint32 height, uint32 rps, int codec)
+{
+    static const int tags[] = { COMPRESSION_NONE, COMPRESSION_PACKBITS, COMPRESSION_LZW, COMPRESSION_ADOBE_DEFLATE };
 
-    for (size_t i=0; i<_depth; ++i) {
-        TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, _width);
-        TIFFSetField(tif, TIFFTAG_IMAGELENGTH, _height);
-        TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, _height);
+    size_t count = (height+rps-1)/rps;
+    for (size_t i=0; i<slices; ++i) {
+        TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, width);
+        TIFFSetField(tif, TIFFTAG_IMAGELENGTH, height);
+        TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, rps);
         TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, 1);
         TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, 8);
-        TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK); 
-        TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_PACKBITS);
-        TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);      
-        TIFFWriteEncodedStrip(tif, 0, _buffer+i*_width*_height, _width*_height);
-        TIFFWriteDirectory(tif);
+        TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
+        TIFFSetField(tif, TIFFTAG_COMPRESSION, tags[codec]);
+        TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+        for (size_t j=0; j<count; ++j) {
+            std::vector<uint8> &strip = strips[i*count+j];
+            if (strip.empty() || TIFFWriteRawStrip(tif, (uint32)j, &strip[0], (tmsize_t)strip.size()) < 0) return false;
+        }
+        if (!TIFFWriteDirectory(tif)) return false;
+    }
+    return true;
+}
+
+bool Volume::WriteTIFF(const char *path) const
+{
+    // strips of about 256 KB, a batch of slices is encoded in parallel while one thread writes the previous batch
+    double t = omp_get_wtime();
+    uint32 rps = (uint32)std::max((size_t)1, std::min(_height, (size_t)(256*1024)/std::max(_width, (size_t)1)));
+    size_t count = (_height+rps-1)/rps, batch = 2*omp_get_max_threads();
+
+    // switch to BigTIFF when the classic 32 bits offsets may not hold the stack once encoded, directories included
+    size_t size = _depth*(count*GetEncodedBound(_codec, rps*_width, rps) + 4096 + 16*count);
+    TIFF *tif = TIFFOpen(path, (size >= 0xC0000000) ? "wb8" : "wb");
+    if (tif == 0) {
+        printf("[Volume::Write] open TIFF file %s failed\n", path);
+        return false;
+    }
+    std::vector<std::vector<uint8> > current(batch*count), previous(batch*count);
+    std::vector<std::vector<short> > tables(omp_get_max_threads()); // LZW dictionaries, 2 MB each, one per thread for the whole write
+    std::vector<std::vector<uint8> > mapped(_lut.empty() ? 0 : omp_get_max_threads()); // mapped strip of each thread
+    size_t written = 0;
+    bool ok = true;
+    for (size_t z0=0; written<_depth && ok; z0+=batch) {
+        size_t z1 = std::min(z0+batch, _depth), slices = std::min(z0, _depth)-written; // encoded last batch
+        #pragma omp parallel
+        {
+            #pragma omp single nowait
+            ok = WriteStrips(tif, previous, slices, (uint32)_width, (uint32)_height, rps, _codec);
+            #pragma omp for schedule(dynamic)
+            for (int i=0; i<(int)((z1>z0 ? z1-z0 : 0)*count); ++i) {
+                size_t z = z0 + i/count, y = (i%count)*rps;
+                uint32 rows = (uint32)std::min((size_t)rps, _height-y);
+                const uint8 *src = _buffer+(z*_height+y)*_width;
+                if (!mapped.empty()) {
+                    std::vector<uint8> &strip = mapped[omp_get_thread_num()];
+                    strip.assign(src, src+rows*_width);
+                    Remap::Lut(&strip[0], _width, rows, _width, &_lut[0]);
+                    src = &strip[0];
+                }
+                EncodeStrip(_codec, src, (uint32)_width, rows, current[i], tables[omp_get_thread_num()]);
+            }
+        }
+        written += slices;
+        current.swap(previous);
     }
     TIFFClose(tif);
-    printf("[Volume::Write] write TIFF file %s ok\n", path);
+    if (!ok) {
+        printf("[Volume::Write] write TIFF file %s failed\n", path);
+        return false;
+    }
+    t = omp_get_wtime()-t;
+    printf("[Volume::Write] write TIFF file %s ok (%ld ms, %.1f slices/s)\n", path, (long)(t*1000.0), _depth/(t>0.0 ? t : 1e-3));
+    return true;
+}
+
+// raw volume file: 64 bytes header & row major depth*height*width voxels, mapped without decoding
+struct RawHeader {
+    char Magic[8];
+    unsigned long long Width, Height, Depth;
+    float Thickness;
+    char Reserved[28];
+};
+
+bool Volume::IsType(const char *path, const char *ext)
+{
+    const char *dot = strrchr(path, '.');
+    if (dot == 0 || strlen(dot) != strlen(ext)) return false;
+    for (size_t i=0; ext[i]!=0; ++i)
+        if (tolower(dot[i]) != ext[i]) return false;
+    return true;
+}
+
+bool Volume::ReadRaw(const char *path)
+{
+    unsigned char *map = 0;
+    size_t length = 0;
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, 0);
+    if (file != INVALID_HANDLE_VALUE) {
+        LARGE_INTEGER size;
+        if (GetFileSizeEx(file, &size)) length = (size_t)size.QuadPart;
+        HANDLE mapping = (length > 0) ? CreateFileMappingA(file, 0, PAGE_WRITECOPY, 0, 0, 0) : 0;
+        if (mapping != 0) {
+            map = (unsigned char*)MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+            CloseHandle(mapping);
+        }
+        CloseHandle(file);
+    }
+#else
+    int file = open(path, O_RDONLY);
+    if (file >= 0) {
+        struct stat st;
+        if (fstat(file, &st) == 0) length = (size_t)st.st_size;
+        if (length > 0) {
+            void *ptr = mmap(0, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+            if (ptr != MAP_FAILED) map = (unsigned char*)ptr;
+        }
+        close(file);
+    }
+#endif
+    if (map == 0) {
+        printf("[Volume::Read] open raw volume file %s failed\n", path);
+        return false;
+    }
+
+    RawHeader header;
+    if (length >= sizeof(RawHeader)) memcpy(&header, map, sizeof(RawHeader));
+    if (length < sizeof(RawHeader) || memcmp(header.Magic, "FLNVOL01", 8) != 0
+        || length-sizeof(RawHeader) < header.Width*header.Height*header.Depth) {
+        printf("[Volume::Read] raw volume file %s has an unsupported header\n", path);
+#ifdef _WIN32
+        UnmapViewOfFile(map);
+#else
+        munmap(map, length);
+#endif
+        return false;
+    }
+    printf("[Volume::Read] map raw volume file %s ok\n", path);
+
+    Release();
+    _map = map;
+    _length = length;
+    _buffer = map + sizeof(RawHeader);
+    _width = (size_t)header.Width;
+    _height = (size_t)header.Height;
+    _depth = (size_t)header.Depth;
+    _thickness = (header.Thickness > 0.0f) ? header.Thickness : 1.0f;
+    return true;
+}
+
+bool Volume::WriteRaw(const char *path) const
+{
+    FILE *file = fopen(path, "wb");
+    if (file == 0) {
+        printf("[Volume::Write] open raw volume file %s failed\n", path);
+        return false;
+    }
+
+    RawHeader header;
+    memset(&header, 0, sizeof(RawHeader));
+    memcpy(header.Magic, "FLNVOL01", 8);
+    header.Width = _width;
+    header.Height = _height;
+    header.Depth = _depth;
+    header.Thickness = _thickness;
+    bool ok = fwrite(&header, sizeof(RawHeader), 1, file) == 1;
+    std::vector<unsigned char> slice(_lut.empty() ? 0 : _width*_height);
+    for (size_t i=0; i<_depth && ok; ++i) {
+        const unsigned char *src = _buffer+i*_width*_height;
+        if (!slice.empty()) {
+            memcpy(&slice[0], src, _width*_height);
+            Remap::Lut(&slice[0], _width, _height, _width, &_lut[0]);
+            src = &slice[0];
+        }
+        ok = fwrite(src, 1, _width*_height, file) == _width*_height;
+    }
+    fclose(file);
+    if (!ok) {
+        printf("[Volume::Write] write raw volume file %s failed\n", path);
+        return false;
+    }
+    printf("[Volume::Write] write raw volume file %s ok\n", path);
+    return true;
+}
+
+bool Volume::ReadBrick(const char *path)
+{
+    static const size_t capacity = (size_t)2048*1024*1024; // bytes of resident bricks
+
+    Bricks *bricks = new Bricks();
+    if (!bricks->Open(path, capacity)) {
+        delete bricks;
+        return false;
+    }
+
+    // texture & global statistics use a maximum downsampled copy no larger than 512 voxels per axis
+    clock_t t = clock();
+    size_t level = (std::max(std::max(bricks->GetWidth(), bricks->GetHeight()), bricks->GetDepth())+511)/512;
+    if (level < 1) level = 1;
+    unsigned char *sample = new unsigned char[((bricks->GetWidth()+level-1)/level)*((bricks->GetHeight()+level-1)/level)*((bricks->GetDepth()+level-1)/level)];
+    bricks->GetSample(sample, level);
+    printf("[Volume::Read] downsample brick volume by level %d ok (%ld ms)\n", (int)level, clock()-t);
+
+    Release();
+    _bricks = bricks;
+    _sample = sample;
+    _level = level;
+    _width = bricks->GetWidth();
+    _height = bricks->GetHeight();
+    _depth = bricks->GetDepth();
+    _thickness = bricks->GetThickness();
+    return true;
+}
+
+void Volume::Release()
+{
+    // stop a progressive read before its buffer goes away
+    _cancel = true;
+    while (_loading) {
+#ifdef _WIN32
+        Sleep(10);
+#else
+        usleep(10000);
+#endif
+    }
+    _pending = false;
+
+    if (_map != 0) {
+#ifdef _WIN32
+        UnmapViewOfFile(_map);
+#else
+        munmap(_map, _length);
+#endif
+    }
+    else if (_buffer != 0) delete[] _buffer;
+    if (_bricks != 0) delete _bricks;
+    if (_sample != 0) delete[] _sample;
+    _buffer = _map = _sample = 0;
+    _bricks = 0;
+    _length = 0;
+    _level = 1;
+    _offx = _offy = _offz = 0;
+    _histogram.clear();
+    _blocks.clear();
+    _field.clear();
+    _fx = _fy = _fz = 0;
+    _lut.clear();
+    _edited = false;
+    _sampler.Reset(this, 0, 0, 0, 0);
+    _sampler.SetMapping(0);
+    ClearPyramid();
+}
+
+int Volume::SetLayout(int layout)
+{
+    _layout = (layout == VOX_BRICK) ? VOX_BRICK : VOX_LINEAR;
+    if (_buffer != 0 && !_pending && _sampler.GetLayout() != _layout) _sampler.Reset(this, _buffer, _width, _height, _depth, _layout);
+    return _layout;
+}
+
+void Volume::SetThickness(float thickness)
+{
+    bool changed = (thickness != _thickness);
+    _thickness = thickness;
+    _scale = std::max(std::max(_width, _height)*1.0f, _depth*_thickness);
+    if (changed && !_levels.empty()) BuildPyramid(); // z reduction follows anisotropy
+}
+
+void Volume::ClearPyramid()
+{
+    for (size_t i=0; i<_levels.size(); ++i) delete[] _levels[i].Buffer;
+    _levels.clear();
+    _dirty.clear();
+}
+
+// level voxels [x0,x1]*[y0,y1]*[z0,z1] as the mean of their 2*2*fz cells of src, cut by its borders
+static void Reduce(const unsigned char *src, size_t width, size_t height, size_t depth, size_t fz, unsigned char *dst, size_t lw, size_t lh,
+    size_t x0, size_t y0, size_t z0, size_t x1, size_t y1, size_t z1)
+{
+    #pragma omp parallel for
+    for (int z=(int)z0; z<=(int)z1; ++z) {
+        size_t sz = z*fz, ez = std::min(sz+fz, depth);
+        for (size_t y=y0; y<=y1; ++y) {
+            size_t sy = y*2, ey = std::min(sy+2, height);
+            for (size_t x=x0; x<=x1; ++x) {
+                size_t sx = x*2, ex = std::min(sx+2, width);
+                size_t sum = 0, count = 0;
+                for (size_t k=sz; k<ez; ++k)
+                    for (size_t j=sy; j<ey; ++j)
+                        for (size_t i=sx; i<ex; ++i, ++count)
+                            sum += src[(k*height+j)*width+i];
+                dst[(z*lh+y)*lw+x] = (unsigned char)((sum+count/2)/count);
+            }
+        }
+    }
+}
+
+void Volume::BuildPyramid()
+{
+    static const size_t lower = 64; // stop once x & y fit in this
+
+    if (_buffer == 0) return;
+
+    clock_t t = clock();
+    ClearPyramid();
+    const unsigned char *src = _buffer;
+    size_t width = _width, height = _height, depth = _depth, scale = 1, scalez = 1;
+    while (std::max(width, height) > lower) {
+        // halve z as well only while its spacing stays within the x & y spacing
+        size_t fz = (scalez*2*_thickness <= scale*2) ? 2 : 1;
+        Level level;
+        level.Width = (width+1)/2;
+        level.Height = (height+1)/2;
+        level.Depth = (depth+fz-1)/fz;
+        level.Scale = scale*2;
+        level.ScaleZ = scalez*fz;
+        level.Buffer = new unsigned char[level.Width*level.Height*level.Depth];
+        Reduce(src, width, height, depth, fz, level.Buffer, level.Width, level.Height, 0, 0, 0, level.Width-1, level.Height-1, level.Depth-1);
+        _levels.push_back(level);
+        src = level.Buffer;
+        width = level.Width;
+        height = level.Height;
+        depth = level.Depth;
+        scale = level.Scale;
+        scalez = level.ScaleZ;
+    }
+    printf("[Volume::BuildPyramid] build %d pyramid levels ok (%ld ms)\n", (int)_levels.size(), clock()-t);
+}
+
+void Volume::UpdatePyramid()
+{
+    if (_dirty.empty() || _buffer == 0) return;
+
+    // the edited box shrinks level by level, only the voxels it covers are reduced again
+    clock_t t = clock();
+    size_t x0 = _dirty[0], y0 = _dirty[1], z0 = _dirty[2], x1 = _dirty[3], y1 = _dirty[4], z1 = _dirty[5];
+    const unsigned char *src = _buffer;
+    size_t width = _width, height = _height, depth = _depth, scalez = 1;
+    for (size_t i=0; i<_levels.size(); ++i) {
+        const Level &level = _levels[i];
+        size_t fz = level.ScaleZ/scalez;
+        x0 /= 2; y0 /= 2; z0 /= fz;
+        x1 /= 2; y1 /= 2; z1 /= fz;
+        Reduce(src, width, height, depth, fz, level.Buffer, level.Width, level.Height, x0, y0, z0, x1, y1, z1);
+        src = level.Buffer;
+        width = level.Width;
+        height = level.Height;
+        depth = level.Depth;
+        scalez = level.ScaleZ;
+    }
+    printf("[Volume::UpdatePyramid] update %d pyramid levels from %d x %d x %d voxels ok (%ld ms)\n", (int)_levels.size(),
+        (int)(_dirty[3]-_dirty[0]+1), (int)(_dirty[4]-_dirty[1]+1), (int)(_dirty[5]-_dirty[2]+1), clock()-t);
+    _dirty.clear();
+}
+
+const unsigned char *Volume::GetLevel(size_t level, size_t &width, size_t &height, size_t &depth)
+{
+    UpdatePyramid();
+    if (level == 0 || level > _levels.size()) {
+        width = _width;
+        height = _height;
+        depth = _depth;
+        return _buffer;
+    }
+    const Level &l = _levels[level-1];
+    width = l.Width;
+    height = l.Height;
+    depth = l.Depth;
+    return l.Buffer;
+}
+
+// pyramid file: 64 bytes header, then per level width, height, depth, scale, scalez & voxels
+struct PyramidHeader {
+    char Magic[8];
+    unsigned long long Width, Height, Depth, Count;
+    float Thickness;
+    char Reserved[4];
+    unsigned long long Size, Time; // of the volume file it was built from
+};
+
+// size & modification time of a file, a pyramid of another version of the volume file is not reused
+static bool GetStamp(const char *path, unsigned long long &size, unsigned long long &time)
+{
+#ifdef _WIN32
+    struct _stat64 st;
+    if (_stat64(path, &st) != 0) return false;
+#else
+    struct stat st;
+    if (stat(path, &st) != 0) return false;
+#endif
+    size = (unsigned long long)st.st_size;
+    time = (unsigned long long)st.st_mtime;
+    return true;
+}
+
+bool Volume::ReadPyramid()
+{
+    unsigned long long size, time;
+    if (_path.empty() || !GetStamp(_path.c_str(), size, time)) return false;
+    std::string path = _path + ".pyr";
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file == 0) return false;
+
+    clock_t t = clock();
+    PyramidHeader header;
+    bool ok = fread(&header, sizeof(PyramidHeader), 1, file) == 1 && memcmp(header.Magic, "FLNPYR02", 8) == 0 &&
+        header.Width == _width && header.Height == _height && header.Depth == _depth && header.Thickness == _thickness &&
+        header.Size == size && header.Time == time;
+    std::vector<Level> levels;
+    for (size_t i=0; ok && i<(size_t)header.Count; ++i) {
+        unsigned long long dims[5];
+        ok = fread(dims, sizeof(dims), 1, file) == 1;
+        if (!ok) break;
+        Level level;
+        level.Width = (size_t)dims[0];
+        level.Height = (size_t)dims[1];
+        level.Depth = (size_t)dims[2];
+        level.Scale = (size_t)dims[3];
+        level.ScaleZ = (size_t)dims[4];
+        level.Buffer = new unsigned char[level.Width*level.Height*level.Depth];
+        levels.push_back(level);
+        ok = fread(level.Buffer, 1, level.Width*level.Height*level.Depth, file) == level.Width*level.Height*level.Depth;
+    }
+    fclose(file);
+    if (!ok) {
+        for (size_t i=0; i<levels.size(); ++i) delete[] levels[i].Buffer;
+        printf("[Volume::ReadPyramid] pyramid file %s does not match volume\n", path.c_str());
+        return false;
+    }
+
+    ClearPyramid();
+    _levels.swap(levels);
+    printf("[Volume::ReadPyramid] read pyramid file %s ok (%ld ms)\n", path.c_str(), clock()-t);
+    return true;
+}
+
+bool Volume::WritePyramid()
+{
+    if (_buffer == 0 || _levels.empty()) return false;
+    unsigned long long size, time;
+    if (_path.empty() || !GetStamp(_path.c_str(), size, time)) {
+        printf("[Volume::WritePyramid] pyramid needs the volume file it is read with\n");
+        return false;
+    }
+    // the stamp is of the file, edited voxels are not on disk & their pyramid would pass for it
+    if (_edited) {
+        printf("[Volume::WritePyramid] volume voxels are edited since read, save & reload the volume first\n");
+        return false;
+    }
+    UpdatePyramid();
+
+    std::string path = _path + ".pyr";
+    FILE *file = fopen(path.c_str(), "wb");
+    if (file == 0) {
+        printf("[Volume::WritePyramid] open pyramid file %s failed\n", path.c_str());
+        return false;
+    }
+
+    PyramidHeader header;
+    memset(&header, 0, sizeof(PyramidHeader));
+    memcpy(header.Magic, "FLNPYR02", 8);
+    header.Width = _width;
+    header.Height = _height;
+    header.Depth = _depth;
+    header.Count = _levels.size();
+    header.Thickness = _thickness;
+    header.Size = size;
+    header.Time = time;
+    bool ok = fwrite(&header, sizeof(PyramidHeader), 1, file) == 1;
+    for (size_t i=0; ok && i<_levels.size(); ++i) {
+        const Level &level = _levels[i];
+        unsigned long long dims[5] = { level.Width, level.Height, level.Depth, level.Scale, level.ScaleZ };
+        ok = fwrite(dims, sizeof(dims), 1, file) == 1 &&
+            fwrite(level.Buffer, 1, level.Width*level.Height*level.Depth, file) == level.Width*level.Height*level.Depth;
+    }
+    fclose(file);
+    if (!ok) {
+        printf("[Volume::WritePyramid] write pyramid file %s failed\n", path.c_str());
+        return false;
+    }
+    printf("[Volume::WritePyramid] write pyramid file %s ok\n", path.c_str());
     return true;
 }
 
@@ -361,70 +1263,44 @@ void Volume::Show() const
     printf("# statistics information of volume:\n");
     printf("#   width %d, height %d, depth %d, thickness %.2f, scale %.2f\n", _width, _height, _depth, _thickness, _scale);
     printf("#   voxels mean %.2f, low %.2f, high %.2f\n", _mean, _low, _high);
+    if (_offx != 0 || _offy != 0 || _offz != 0) printf("#   region offset x %d, y %d, z %d\n", (int)_offx, (int)_offy, (int)_offz);
+    if (_bricks != 0) printf("#   out-of-core bricks resident %d, sample level %d\n", (int)_bricks->GetResident(), (int)_level);
+    for (size_t i=0; i<_levels.size(); ++i)
+        printf("#   pyramid level %d, width %d, height %d, depth %d\n", (int)i+1, (int)_levels[i].Width, (int)_levels[i].Height, (int)_levels[i].Depth);
 }
 
-void Volume::SetSample(int level) const
+void Volume::SetSample(int level)
 {
     if (_buffer == 0 || !glIsTexture(_texture) || level <= 0)  return;
 
-    unsigned char *buffer = _buffer;
-    size_t width = _width/level, height = _height/level, depth = _depth;
-    if (level != 1) {
-        clock_t t = clock();
-        buffer = new unsigned char[width*height*depth];
-        float value = 0.0f;
-        #pragma omp parallel for private(value)
-        for (int z=0; z<(int)depth; ++z) {
-            for (size_t y=0; y<height; ++y) {
-                for (size_t x=0; x<width; ++x) {
-                    value = 0.0f;
-                    for (int i=1-level; i<=level-1; ++i) {
-                        for (int j=1-level; j<=level-1; ++j) {
-                            value += GetVoxel(level*x+i, level*y+j, z);
-                        }
-                    }
-                    value /= ((2*level-1)*(2*level-1));
-                    buffer[z*height*width + y*width + x] = (unsigned char)value;
-                }
-            }
-        }
-        printf("[Volume::SetSample] downsampling volume ok (%ld ms)\n", clock()-t);
-    }
+    // pick the coarsest pyramid level reduced by at most level in x & y, 3 takes the 2x one
+    size_t id = 0;
+    while (id < _levels.size() && _levels[id].Scale <= (size_t)level) ++id;
+    size_t width, height, depth;
+    const unsigned char *buffer = GetLevel(id, width, height, depth);
 
     glBindTexture(GL_TEXTURE_3D, _texture);
     glTexImage3D(GL_TEXTURE_3D, 0, GL_INTENSITY, width, height, depth, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, buffer);
-    if (buffer != _buffer) delete[] buffer;
+    printf("[Volume::SetSample] use pyramid level %d, width %d, height %d, depth %d\n", (int)id, (int)width, (int)height, (int)depth);
 }
 
 void Volume::SetColor(const unsigned char *color) const
 {
     if (!glIsTexture(_color)) return;
+
+    // the 3D texture keeps raw voxels, a pending mapping is folded into the colormap
+    unsigned char value[256];
+    if (!_lut.empty() && color != 0) {
+        for (int v=0; v<256; ++v) value[v] = color[_lut[v]];
+        color = value;
+    }
     glBindTexture(GL_TEXTURE_1D, _color);
     glTexImage1D(GL_TEXTURE_1D, 0, GL_INTENSITY, 256, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, color);
 }
 
-float Volume::GetVoxel(float x, float y, float z) const
-{
-    if (_buffer == 0 || x < 0.0f || y < 0.0f || z < 0.0f)  return 0.0f;
-
-    size_t x0 = (size_t)x;
-    size_t x1 = x0+1;
-    size_t y0 = (size_t)y;
-    size_t y1 = y0+1;
-    size_t z0 = (size_t)z;
-    size_t z1 = z0+1;
-    float xiy0z0 = GetVoxel(x0,y0,z0)*(x1-x) + GetVoxel(x1,y0,z0)*(x-x0);
-    float xiy1z0 = GetVoxel(x0,y1,z0)*(x1-x) + GetVoxel(x1,y1,z0)*(x-x0);
-    float xiyiz0 = xiy0z0*(y1-y) + xiy1z0*(y-y0);
-    float xiy0z1 = GetVoxel(x0,y0,z1)*(x1-x) + GetVoxel(x1,y0,z1)*(x-x0);
-    float xiy1z1 = GetVoxel(x0,y1,z1)*(x1-x) + GetVoxel(x1,y1,z1)*(x-x0);
-    float xiyiz1 = xiy0z1*(y1-y) + xiy1z1*(y-y0);
-    return xiyiz0*(z1-z) + xiyiz1*(z-z0);
-}
-
 Point Volume::GetPoint(float x, float y, float z) const
 {
-    if (_buffer == 0) return Point();
+    if (!IsValid()) return Point();
 
     Point point;
     point.X = (_scale*x+_width)/2.0f;
@@ -435,7 +1311,7 @@ Point Volume::GetPoint(float x, float y, float z) const
 
 Point Volume::GetPoint(const Point &point0, const Point &point1) const
 {
-    if (_buffer == 0)  return Point();
+    if (!IsValid())  return Point();
 
     int dx = (int)abs(point0.X-point1.X), dy = (int)abs(point0.Y-point1.Y), dz = (int)abs(point0.Z-point1.Z);
     int ds = (dx>dy) ? (dx>dz ? dx+1 : dz+1) : (dy>dz ? dy+1 : dz+1);
@@ -452,112 +1328,178 @@ Point Volume::GetPoint(const Point &point0, const Point &point1) const
     return point;
 }
 
+void Volume::Prefetch(const Point &point, float i, float j, float k, float dist) const
+{
+    if (_bricks == 0) return;
+
+    // page in bricks around the point and ahead along direction before rays sample them
+    float x = point.X + i*dist*0.5f, y = point.Y + j*dist*0.5f, z = point.Z + k*dist*0.5f;
+    float r = dist + 1.0f, rz = dist/_thickness + 1.0f;
+    size_t x0 = (x>r) ? (size_t)(x-r) : 0, y0 = (y>r) ? (size_t)(y-r) : 0, z0 = (z>rz) ? (size_t)(z-rz) : 0;
+    if (x+r < 0.0f || y+r < 0.0f || z+rz < 0.0f) return;
+    _bricks->Prefetch(x0, y0, z0, (size_t)(x+r), (size_t)(y+r), (size_t)(z+rz));
+}
+
+void Volume::GetCube(size_t x, size_t y, size_t z, unsigned char *cube) const
+{
+    if (_bricks != 0 && _buffer == 0) _bricks->GetCube(x, y, z, cube);
+    else {
+        for (int i=0; i<8; ++i) {
+            size_t cx = x+(i&1), cy = y+((i>>1)&1), cz = z+(i>>2);
+            cube[i] = (_buffer != 0 && cx < _width && cy < _height && cz < _depth) ? _buffer[(cz*_height+cy)*_width+cx] : 0;
+        }
+    }
+    if (_lut.empty()) return;
+    for (int i=0; i<8; ++i) cube[i] = _lut[cube[i]];
+}
+
+const unsigned char *Volume::GetRegion(size_t &x0, size_t &y0, size_t &z0, size_t &x1, size_t &y1, size_t &z1, size_t &width, size_t &height, unsigned char *&region) const
+{
+    region = 0;
+    width = _width;
+    height = _height;
+    if (_buffer != 0) return _buffer;
+    if (_bricks == 0) return 0;
+
+    // large regions of out-of-core volume are scanned on the downsampled copy
+    if ((x1-x0+1)*(y1-y0+1)*(z1-z0+1) > (size_t)256*1024*1024) {
+        x0 /= _level; y0 /= _level; z0 /= _level;
+        x1 /= _level; y1 /= _level; z1 /= _level;
+        width = (_width+_level-1)/_level;
+        height = (_height+_level-1)/_level;
+        return _sample;
+    }
+
+    width = x1-x0+1;
+    height = y1-y0+1;
+    region = new unsigned char[width*height*(z1-z0+1)];
+    _bricks->GetRegion(region, x0, y0, z0, x1, y1, z1);
+    x1 -= x0; y1 -= y0; z1 -= z0;
+    x0 = y0 = z0 = 0;
+    return region;
+}
+
 void Volume::GetValue(float &mean, float &low, float &high, size_t x, size_t y, size_t z, size_t radius) const
 {
-    if (_buffer == 0 || x >= _width || y >= _height || z >= _depth) {
+    if (!IsValid() || x >= _width || y >= _height || z >= _depth) {
         mean = low = high = 0.0f;
         return;
     }
 
-    size_t x0 = (x<radius) ? 0 : (x-radius);
-    size_t x1 = (x+radius>=_width) ? (_width-1) : (x+radius);
-    size_t y0 = (y<radius) ? 0 : (y-radius);
-    size_t y1 = (y+radius>=_height) ? (_height-1) : (y+radius);
-    size_t z0 = (z<radius) ? 0 : (z-radius);
-    size_t z1 = (z+radius>=_depth) ? (_depth-1) : (z+radius);
-    
-    size_t nb, nf;
-    double b, f, t0, t1; // OVERFLOW
-    nb = nf = 0;
-    b = f = t0 = t1 = 0.0;
-
-    unsigned char v;
-    #pragma omp parallel for private(v) reduction(+:nf,f)
-    for (int i=z0; i<=(int)z1; ++i) {
-        for (size_t j=y0; j<=y1; ++j) {
-            for (size_t k=x0; k<=x1; ++k) {
-                v = _buffer[i*_height*_width+j*_width+k];
-                if (v >= 0 && v <= 255) {
-                    ++nf;
-                    f += v/255.0;
-                }
-            }
-        }
+    // one pass for the histogram, isodata iterates over its bins
+    double index[256];
+    GetIndex(index, x, y, z, radius);
+    IsoData(index, mean, low, high);
+}
+
+bool Volume::GetLocalValue(float &mean, float &low, float &high, float x, float y, float z) const
+{
+    static const float size = (float)block;
+    if (_field.empty()) return false;
+
+    // blocks centres are the samples, clamped on the borders
+    float u = x/size-0.5f, v = y/size-0.5f, w = z/size-0.5f;
+    u = (u < 0.0f) ? 0.0f : (u > _fx-1.0f) ? _fx-1.0f : u;
+    v = (v < 0.0f) ? 0.0f : (v > _fy-1.0f) ? _fy-1.0f : v;
+    w = (w < 0.0f) ? 0.0f : (w > _fz-1.0f) ? _fz-1.0f : w;
+    size_t i0 = (size_t)u, j0 = (size_t)v, k0 = (size_t)w;
+    size_t i1 = std::min(i0+1, _fx-1), j1 = std::min(j0+1, _fy-1), k1 = std::min(k0+1, _fz-1);
+    float fu = u-i0, fv = v-j0, fw = w-k0;
+
+    float value[3];
+    for (int c=0; c<3; ++c) {
+        float v00 = _field[3*((k0*_fy+j0)*_fx+i0)+c]*(1.0f-fu) + _field[3*((k0*_fy+j0)*_fx+i1)+c]*fu;
+        float v10 = _field[3*((k0*_fy+j1)*_fx+i0)+c]*(1.0f-fu) + _field[3*((k0*_fy+j1)*_fx+i1)+c]*fu;
+        float v01 = _field[3*((k1*_fy+j0)*_fx+i0)+c]*(1.0f-fu) + _field[3*((k1*_fy+j0)*_fx+i1)+c]*fu;
+        float v11 = _field[3*((k1*_fy+j1)*_fx+i0)+c]*(1.0f-fu) + _field[3*((k1*_fy+j1)*_fx+i1)+c]*fu;
+        value[c] = (v00*(1.0f-fv) + v10*fv)*(1.0f-fw) + (v01*(1.0f-fv) + v11*fv)*fw;
     }
-    if (nf > 0) t1 = f/nf*255.0;
-    mean = (float)t1;
+    mean = value[0];
+    low = value[1];
+    high = value[2];
+    return true;
+}
 
-    do {
-        nb = nf = 0;
-        b = f = 0.0;
-        t0 = t1;
-        #pragma omp parallel for private(v) reduction(+:nb,b,nf,f)
-        for (int i=z0; i<=(int)z1; ++i) {
-            for (size_t j=y0; j<=y1; ++j) {
-                for (size_t k=x0; k<=x1; ++k) {
-                    v = _buffer[i*_height*_width+j*_width+k];
-                    if (v >= 0 && v < t0) {
-                        ++nb;
-                        b += v/255.0;
-                    }
-                    else if (v >= t0 && v <= 255) {
-                        ++nf;
-                        f += v/255.0;
-                    }
-                }
+void Volume::BuildBlocks()
+{
+    _blocks.clear();
+    _field.clear();
+    _fx = _fy = _fz = 0;
+    if (_buffer == 0 || _width == 0 || _height == 0 || _depth == 0) return;
+
+    // histogram & isodata of every block, one block per task
+    clock_t t = clock();
+    _fx = (_width+block-1)/block;
+    _fy = (_height+block-1)/block;
+    _fz = (_depth+block-1)/block;
+    _blocks.assign(256*_fx*_fy*_fz, 0);
+    _field.assign(3*_fx*_fy*_fz, 0.0f);
+    #pragma omp parallel for schedule(dynamic)
+    for (int b=0; b<(int)(_fx*_fy*_fz); ++b) {
+        size_t sx = (b%_fx)*block, sy = ((b/_fx)%_fy)*block, sz = (b/(_fx*_fy))*block;
+        size_t ex = std::min(sx+block, _width), ey = std::min(sy+block, _height), ez = std::min(sz+block, _depth);
+        unsigned short *bins = &_blocks[256*b];
+        for (size_t z=sz; z<ez; ++z) {
+            for (size_t y=sy; y<ey; ++y) {
+                const unsigned char *row = _buffer + (z*_height+y)*_width;
+                for (size_t x=sx; x<ex; ++x) ++bins[row[x]];
             }
         }
-        if (nb > 0) b = b/nb*255.0;
-        if (nf > 0) f = f/nf*255.0;
-        t1 = (b+f)/2.0f;
-    } while (abs(t1-t0) > 0.5);
-    low = (float)b;
-    high = (float)f;
+        IsoData(bins, _lut.empty() ? 0 : &_lut[0], &_field[3*b]);
+    }
+    printf("[Volume::BuildBlocks] build %d x %d x %d blocks histograms & threshold field ok (%ld ms)\n", (int)_fx, (int)_fy, (int)_fz, clock()-t);
 }
 
 void Volume::SetValue(int low, int high, size_t x, size_t y, size_t z, size_t radius)
 {
-    if (_buffer == 0 || x >= _width || y >= _height || z >= _depth) return;
-
-    size_t x0 = (x<radius) ? 0 : (x-radius);
-    size_t x1 = (x+radius>=_width) ? (_width-1) : (x+radius);
-    size_t y0 = (y<radius) ? 0 : (y-radius);
-    size_t y1 = (y+radius>=_height) ? (_height-1) : (y+radius);
-    size_t z0 = (z<radius) ? 0 : (z-radius);
-    size_t z1 = (z+radius>=_depth) ? (_depth-1) : (z+radius);
-
     if (low < 0) low = 0;
     if (high > 255) high = 255;
-    float diff = 255.0f/(high-low);
-    unsigned char *ptr = _buffer;
-    #pragma omp parallel for private(ptr)
-    for (int i=z0; i<=(int)z1; ++i) {
-        for (size_t j=y0; j<=y1; ++j) {
-            for (size_t k=x0; k<=x1; ++k) {
-                ptr = _buffer + i*_height*_width + j*_width + k;
-                if(*ptr < low) *ptr = low;
-                else if(*ptr > high) *ptr = high;
-                *ptr = (unsigned char)((*ptr-low)*diff);
-            }
-        }
-    }
 
-    if (!glIsTexture(_texture)) return;
-    glBindTexture(GL_TEXTURE_3D, _texture);
-    glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, z0, _width, _height, z1-z0+1, GL_LUMINANCE, GL_UNSIGNED_BYTE, _buffer+z0*_height*_width);
+    // the same kernel on all 256 values gives the table for the histograms
+    unsigned char value[256];
+    for (int v=0; v<256; ++v) value[v] = (unsigned char)v;
+    Remap::Window(value, 256, 1, 0, low, high);
+    Apply(value, low, high, x, y, z, radius);
 }
 
 void Volume::SetValue(int low, int high)
 {
+    if (_bricks != 0) {
+        printf("[Volume::SetValue] remapping out-of-core volume voxels is unsupported\n");
+        return;
+    }
     SetValue(low, high, 0, 0, 0, (size_t)(_scale+0.5f));
-    clock_t t = clock();
-    GetValue(_mean, _low, _high, 0, 0, 0, (size_t)(_scale+0.5f));
-    printf("[Volume::SetValue] calculate volume voxel values ok (%ld ms)\n", clock()-t);
+    UpdateValue();
+}
+
+void Volume::UpdateValue()
+{
+    if (_histogram.size() != 256) return;
+
+    double index[256];
+    memset(index, 0, 256*sizeof(double));
+    for (int v=0; v<256; ++v) index[_lut.empty() ? v : _lut[v]] += _histogram[v];
+    IsoData(index, _mean, _low, _high);
 }
 
 void Volume::GetIndex(double *index, size_t x, size_t y, size_t z, size_t radius) const
 {
-    if (_buffer == 0 || index == 0 || x >= _width || y >= _height || z >= _depth) return;
+    if (!IsValid() || index == 0 || x >= _width || y >= _height || z >= _depth) return;
+    if (_lut.empty()) {
+        GetRawIndex(index, x, y, z, radius);
+        return;
+    }
+
+    // raw bins are moved to their mapped values
+    double raw[256];
+    GetRawIndex(raw, x, y, z, radius);
+    for (int v=0; v<256; ++v) index[v] = 0.0;
+    for (int v=0; v<256; ++v) index[_lut[v]] += raw[v];
+}
+
+void Volume::GetRawIndex(double *index, size_t x, size_t y, size_t z, size_t radius) const
+{
+    if (!IsValid() || index == 0 || x >= _width || y >= _height || z >= _depth) return;
 
     size_t x0 = (x<radius) ? 0 : (x-radius);
     size_t x1 = (x+radius>=_width) ? (_width-1) : (x+radius);
@@ -566,17 +1508,72 @@ void Volume::GetIndex(double *index, size_t x, size_t y, size_t z, size_t radius
     size_t z0 = (z<radius) ? 0 : (z-radius);
     size_t z1 = (z+radius>=_depth) ? (_depth-1) : (z+radius);
 
-    for (int i=0; i<256; ++i) index[i] = 0.0; // OVERFLOW
-    for (size_t i=z0; i<=z1; ++i) {
-        for (size_t j=y0; j<=y1; ++j) {
-            for (size_t k=x0; k<=x1; ++k) {
-                index[_buffer[i*_height*_width+j*_width+k]] += 1.0f;
+    // whole volume histogram is kept up to date by loads & remaps
+    if (_histogram.size() == 256 && !_pending && x0 == 0 && y0 == 0 && z0 == 0 && x1 == _width-1 && y1 == _height-1 && z1 == _depth-1) {
+        memcpy(index, &_histogram[0], 256*sizeof(double));
+        return;
+    }
+
+    for (int i=0; i<256; ++i) index[i] = 0.0;
+    if (!_blocks.empty()) {
+        // blocks inside the box add their histogram, blocks cut by its faces are scanned
+        size_t bx0 = x0/block, by0 = y0/block, bz0 = z0/block;
+        size_t nx = x1/block-bx0+1, ny = y1/block-by0+1, nz = z1/block-bz0+1;
+        #pragma omp parallel
+        {
+            double bins[256];
+            memset(bins, 0, 256*sizeof(double));
+            #pragma omp for schedule(dynamic)
+            for (int b=0; b<(int)(nx*ny*nz); ++b) {
+                size_t bx = bx0 + b%nx, by = by0 + (b/nx)%ny, bz = bz0 + b/(nx*ny);
+                size_t sx = std::max(bx*block, x0), sy = std::max(by*block, y0), sz = std::max(bz*block, z0);
+                size_t ex = std::min(bx*block+block, x1+1), ey = std::min(by*block+block, y1+1), ez = std::min(bz*block+block, z1+1);
+                if (sx == bx*block && sy == by*block && sz == bz*block &&
+                    ex == std::min(bx*block+block, _width) && ey == std::min(by*block+block, _height) && ez == std::min(bz*block+block, _depth)) {
+                    const unsigned short *h = &_blocks[256*((bz*_fy+by)*_fx+bx)];
+                    for (int v=0; v<256; ++v) bins[v] += h[v];
+                    continue;
+                }
+                for (size_t z=sz; z<ez; ++z) {
+                    for (size_t y=sy; y<ey; ++y) {
+                        const unsigned char *row = _buffer + (z*_height+y)*_width;
+                        for (size_t x=sx; x<ex; ++x) bins[row[x]] += 1.0;
+                    }
+                }
             }
+            #pragma omp critical
+            for (int v=0; v<256; ++v) index[v] += bins[v];
         }
+        return;
     }
+
+    size_t width, height;
+    unsigned char *region;
+    const unsigned char *buffer = GetRegion(x0, y0, z0, x1, y1, z1, width, height, region);
+
+    #pragma omp parallel
+    {
+        double bins[256];
+        memset(bins, 0, 256*sizeof(double));
+        #pragma omp for
+        for (int i=z0; i<=(int)z1; ++i) {
+            for (size_t j=y0; j<=y1; ++j) {
+                const unsigned char *row = buffer + i*height*width + j*width;
+                for (size_t k=x0; k<=x1; ++k) bins[row[k]] += 1.0;
+            }
+        }
+        #pragma omp critical
+        for (int v=0; v<256; ++v) index[v] += bins[v];
+    }
+    if (region != 0) delete[] region;
 }
 
 void Volume::SetValue(const unsigned char *value, size_t x, size_t y, size_t z, size_t radius)
+{
+    Apply(value, -1, -1, x, y, z, radius);
+}
+
+void Volume::Apply(const unsigned char *value, int low, int high, size_t x, size_t y, size_t z, size_t radius)
 {
     if (_buffer == 0 || value == 0 || x >= _width || y >= _height || z >= _depth) return;
 
@@ -587,14 +1584,67 @@ void Volume::SetValue(const unsigned char *value, size_t x, size_t y, size_t z,
     size_t z0 = (z<radius) ? 0 : (z-radius);
     size_t z1 = (z+radius>=_depth) ? (_depth-1) : (z+radius);
 
-    unsigned char *ptr = _buffer;
-    #pragma omp parallel for private(ptr)
-    for (int i=z0; i<=(int)z1; ++i) {
-        for (size_t j=y0; j<=y1; ++j) {
-            for (size_t k=x0; k<=x1; ++k) {
-                ptr = _buffer + i*_height*_width + j*_width + k;
-                *ptr = value[*ptr];
+    // rows are remapped by the SIMD kernels, block histograms, field & whole histogram follow from the old counts
+    size_t bx0 = x0/block, by0 = y0/block, bz0 = z0/block;
+    size_t nx = x1/block-bx0+1, ny = y1/block-by0+1, nz = z1/block-bz0+1;
+    double moved[256];
+    memset(moved, 0, 256*sizeof(double));
+    #pragma omp parallel
+    {
+        double bins[256];
+        memset(bins, 0, 256*sizeof(double));
+        #pragma omp for schedule(dynamic)
+        for (int b=0; b<(int)(nx*ny*nz); ++b) {
+            size_t bx = bx0 + b%nx, by = by0 + (b/nx)%ny, bz = bz0 + b/(nx*ny);
+            size_t sx = std::max(bx*block, x0), sy = std::max(by*block, y0), sz = std::max(bz*block, z0);
+            size_t ex = std::min(bx*block+block, x1+1), ey = std::min(by*block+block, y1+1), ez = std::min(bz*block+block, z1+1);
+            size_t id = (bz*_fy+by)*_fx+bx;
+            unsigned short *h = _blocks.empty() ? 0 : &_blocks[256*id];
+            unsigned count[256];
+            if (h != 0 && sx == bx*block && sy == by*block && sz == bz*block &&
+                ex == std::min(bx*block+block, _width) && ey == std::min(by*block+block, _height) && ez == std::min(bz*block+block, _depth)) {
+                for (int v=0; v<256; ++v) count[v] = h[v];
+            }
+            else {
+                memset(count, 0, 256*sizeof(unsigned));
+                for (size_t z=sz; z<ez; ++z) {
+                    for (size_t y=sy; y<ey; ++y) {
+                        const unsigned char *row = _buffer + (z*_height+y)*_width;
+                        for (size_t x=sx; x<ex; ++x) ++count[row[x]];
+                    }
+                }
             }
+            for (size_t z=sz; z<ez; ++z) {
+                unsigned char *row = _buffer + (z*_height+sy)*_width + sx;
+                if (low >= 0) Remap::Window(row, ex-sx, ey-sy, _width, low, high);
+                else Remap::Lut(row, ex-sx, ey-sy, _width, value);
+            }
+            for (int v=0; v<256; ++v) bins[v] += count[v];
+            if (h != 0) {
+                for (int v=0; v<256; ++v) h[v] = (unsigned short)(h[v]-count[v]);
+                for (int v=0; v<256; ++v) h[value[v]] = (unsigned short)(h[value[v]]+count[v]);
+                IsoData(h, _lut.empty() ? 0 : &_lut[0], &_field[3*id]);
+            }
+        }
+        #pragma omp critical
+        for (int v=0; v<256; ++v) moved[v] += bins[v];
+    }
+    if (_histogram.size() == 256) {
+        for (int v=0; v<256; ++v) _histogram[v] -= moved[v];
+        for (int v=0; v<256; ++v) _histogram[value[v]] += moved[v];
+    }
+    _sampler.Update(x0, y0, z0, x1, y1, z1);
+    _edited = true;
+
+    // pyramid levels are reduced again when next used
+    if (!_levels.empty()) {
+        if (_dirty.empty()) {
+            size_t box[6] = { x0, y0, z0, x1, y1, z1 };
+            _dirty.assign(box, box+6);
+        }
+        else {
+            _dirty[0] = std::min(_dirty[0], x0); _dirty[1] = std::min(_dirty[1], y0); _dirty[2] = std::min(_dirty[2], z0);
+            _dirty[3] = std::max(_dirty[3], x1); _dirty[4] = std::max(_dirty[4], y1); _dirty[5] = std::max(_dirty[5], z1);
         }
     }
 
@@ -605,8 +1655,149 @@ void Volume::SetValue(const unsigned char *value, size_t x, size_t y, size_t z,
 
 void Volume::SetValue(const unsigned char *value)
 {
+    if (_bricks != 0) {
+        printf("[Volume::SetValue] remapping out-of-core volume voxels is unsupported\n");
+        return;
+    }
     SetValue(value, 0, 0, 0, (size_t)(_scale+0.5f));
+    UpdateValue();
+}
+
+void Volume::SetMapping(const unsigned char *value)
+{
+    if (!IsValid()) return;
+
+    // new mapping applies on top of the pending one, identity drops it
+    clock_t t = clock();
+    unsigned char lut[256];
+    bool identity = true;
+    for (int v=0; v<256; ++v) {
+        lut[v] = (value == 0) ? (unsigned char)v : value[_lut.empty() ? v : _lut[v]];
+        if (lut[v] != v) identity = false;
+    }
+    if (identity) _lut.clear();
+    else _lut.assign(lut, lut+256);
+    _sampler.SetMapping(_lut.empty() ? 0 : &_lut[0]);
+
+    // statistics follow from the raw histograms, no voxel is visited
+    const unsigned char *map = _lut.empty() ? 0 : &_lut[0];
+    #pragma omp parallel for
+    for (int b=0; b<(int)(_blocks.size()/256); ++b) IsoData(&_blocks[256*b], map, &_field[3*b]);
+    UpdateValue();
+    printf("[Volume::SetMapping] set volume voxel mapping ok (%ld ms)\n", clock()-t);
+}
+
+void Volume::Filter(const Preprocess &chain)
+{
+    if (chain.IsEmpty()) return;
+    if (_buffer == 0 || _pending) {
+        printf("[Volume::Filter] preprocessing needs a loaded in-memory volume\n");
+        return;
+    }
+
+    // raw voxels are filtered, everything derived from them is rebuilt
+    clock_t t = clock();
+    chain.Run(_buffer, _buffer, _width, _height, _depth, _thickness);
+    Refresh();
+    printf("[Volume::Filter] preprocess volume voxels ok (%ld ms)\n", clock()-t);
+}
+
+// LUT taking a slice histogram to the reference cdf, by its percentiles or by the whole cdf
+static void Match(const double *index, const double *cdf, int mode, float low, float high, unsigned char *lut)
+{
+    double n = 0.0, c[256];
+    for (int v=0; v<256; ++v) c[v] = n += index[v];
+    for (int v=0; v<256; ++v) lut[v] = (unsigned char)v;
+    if (n <= 0.0) return;
+    for (int v=0; v<256; ++v) c[v] /= n;
+
+    if (mode == NORM_HISTOGRAM) {
+        int u = 0;
+        for (int v=0; v<256; ++v) {
+            while (u < 255 && cdf[u] < c[v]) ++u;
+            lut[v] = (unsigned char)u;
+        }
+        return;
+    }
+    int a = 0, b = 0, ra = 0, rb = 0;
+    while (a < 255 && c[a] < low) ++a;
+    while (b < 255 && c[b] < high) ++b;
+    while (ra < 255 && cdf[ra] < low) ++ra;
+    while (rb < 255 && cdf[rb] < high) ++rb;
+    if (b <= a) return;
+    for (int v=0; v<256; ++v) {
+        double u = ra + (v-a)*(double)(rb-ra)/(b-a) + 0.5;
+        lut[v] = (unsigned char)((u < 0.0) ? 0 : (u > 255.0) ? 255 : (int)u);
+    }
+}
+
+void Volume::Normalize(int mode, size_t slab, float low, float high)
+{
+    if (_buffer == 0 || _pending || _histogram.size() != 256) {
+        printf("[Volume::Normalize] normalization needs a loaded in-memory volume\n");
+        return;
+    }
+
+    // every slice histogram in one sweep, then the whole volume cdf as reference
+    clock_t t = clock();
+    size_t size = _width*_height, half = (slab > 1) ? slab/2 : 0;
+    std::vector<double> slices(256*_depth, 0.0);
+    #pragma omp parallel for
+    for (int z=0; z<(int)_depth; ++z) {
+        double *h = &slices[256*z];
+        const unsigned char *p = _buffer + z*size;
+        for (size_t i=0; i<size; ++i) h[p[i]] += 1.0;
+    }
+    double cdf[256], n = 0.0;
+    for (int v=0; v<256; ++v) cdf[v] = n += _histogram[v];
+    for (int v=0; v<256; ++v) cdf[v] /= (n > 0.0) ? n : 1.0;
+
+    // each slice is matched through the histogram of the slab around it
+    #pragma omp parallel for
+    for (int z=0; z<(int)_depth; ++z) {
+        size_t z0 = ((size_t)z < half) ? 0 : z-half, z1 = std::min(z+half, _depth-1);
+        double index[256];
+        memset(index, 0, 256*sizeof(double));
+        for (size_t k=z0; k<=z1; ++k)
+            for (int v=0; v<256; ++v) index[v] += slices[256*k+v];
+        unsigned char lut[256];
+        Match(index, cdf, mode, low, high, lut);
+        Remap::Lut(_buffer+z*size, size, 1, 0, lut);
+    }
+    Refresh();
+    printf("[Volume::Normalize] normalize %d slices by %s matching ok (%ld ms)\n", (int)_depth, (mode == NORM_HISTOGRAM) ? "histogram" : "percentile", clock()-t);
+}
+
+void Volume::Refresh()
+{
+    _edited = true;
+    _sampler.Update(0, 0, 0, _width-1, _height-1, _depth-1);
+    BuildBlocks();
+    double index[256];
+    _histogram.clear();
+    GetRawIndex(index, 0, 0, 0, (size_t)(_scale+0.5f));
+    _histogram.assign(index, index+256);
+    UpdateValue();
+    if (!_levels.empty()) BuildPyramid();
+
+    if (!glIsTexture(_texture)) return;
+    glBindTexture(GL_TEXTURE_3D, _texture);
+    glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, _width, _height, _depth, GL_LUMINANCE, GL_UNSIGNED_BYTE, _buffer);
+}
+
+void Volume::Bake()
+{
+    if (_lut.empty()) return;
+    if (_bricks != 0) {
+        printf("[Volume::Bake] baking out-of-core volume voxels is unsupported\n");
+        return;
+    }
+
+    // voxels take the mapped values, which leaves nothing pending
     clock_t t = clock();
-    GetValue(_mean, _low, _high, 0, 0, 0, (size_t)(_scale+0.5f));
-    printf("[Volume::SetValue] calculate volume voxel values ok (%ld ms)\n", clock()-t);
+    std::vector<unsigned char> lut;
+    lut.swap(_lut);
+    _sampler.SetMapping(0);
+    SetValue(&lut[0]);
+    printf("[Volume::Bake] bake volume voxel mapping ok (%ld ms)\n", clock()-t);
 }
@@ -39,7 +39,14 @@ Window::Window(int w, int h, const char *label)
 
     _menu3d->align(FL_ALIGN_TOP | FL_ALIGN_INSIDE);
     _menu3d->add("&File/Load File\t", FL_COMMAND+'o', FileLoad, (void*)this);
-    _menu3d->add("&File/Save File\t", FL_COMMAND+'s', FileSave, (void*)this, FL_MENU_DIVIDER);
+    _menu3d->add("&File/Load Volume Region\t", 0, FileRegion, (void*)this);
+    _menu3d->add("&File/Save File\t", FL_COMMAND+'s', FileSave, (void*)this);
+    _menu3d->add("&File/TIFF Compression/None\t", 0, CodecNone, (void*)this, FL_MENU_RADIO);
+    _menu3d->add("&File/TIFF Compression/PackBits\t", 0, CodecPackBits, (void*)this, FL_MENU_RADIO | FL_MENU_VALUE);
+    _menu3d->add("&File/TIFF Compression/LZW\t", 0, CodecLZW, (void*)this, FL_MENU_RADIO);
+    _menu3d->add("&File/TIFF Compression/Deflate\t", 0, CodecDeflate, (void*)this, FL_MENU_RADIO);
+    _menu3d->add("&File/Voxel Layout/Linear\t", 0, LayoutLinear, (void*)this, FL_MENU_RADIO | FL_MENU_VALUE);
+    _menu3d->add("&File/Voxel Layout/8x8x8 Bricks\t", 0, LayoutBrick, (void*)this, FL_MENU_RADIO | FL_MENU_DIVIDER);
     _menu3d->add("&File/Save Scene\t", 0, SceneSave, (void*)this, FL_MENU_DIVIDER);
     _menu3d->add("&File/Quit", 0, Quit);
 
@@ -61,16 +68,17 @@ Window::Window(int w, int h, const char *label)
     _ids[10] = _menu3d->add("&Edit/Tracing Options/Set Global Parameters\t", 0, TreeParam, (void*)this);
     _ids[11] = _menu3d->add("&Edit/Tracing Options/Using Local Parameters\t", 0, TreeLocal, (void*)this, FL_MENU_TOGGLE);
     _ids[12] = _menu3d->add("&Edit/Tracing Options/Link Gap Tree\t", 0, TreeLink, (void*)this, FL_MENU_TOGGLE);
-    _ids[13] = _menu3d->add("&Edit/Update Tracing\t", 0, TreeUpdate, (void*)this);
-    _ids[14] = _menu3d->add("&Edit/Cancel Tracing\t", FL_COMMAND+'e', TreeCancel, (void*)this);
-    _ids[15] = _menu3d->add("&Edit/Remove Last Tree\t", FL_Delete, TreeRemove, (void*)this);
-    _ids[16] = _menu3d->add("&Edit/Clear Tree\t", FL_SHIFT+FL_Delete, TreeClear, (void*)this);
-    _ids[17] = _menu3d->add("&Edit/Reduce Tree\t", FL_COMMAND+'r', TreeReduce, (void*)this);    
-    _ids[18] = _menu3d->add("&Edit/Prune Short Tree\t", 0, TreePrune, (void*)this);
-    _ids[19] = _menu3d->add("&Edit/Stretch Tree\t", 0, TreeStretch, (void*)this);
-    _ids[20] = _menu3d->add("&Edit/Fixup Thin Tree\t", 0, TreeFixup, (void*)this);
-
-    for (int i=0; i<21; ++i) _menu3d->mode(_ids[i], _menu3d->mode(_ids[i]) | FL_MENU_INACTIVE);
+    _ids[13] = _menu3d->add("&Edit/Tracing Options/Skip Traced Neurites\t", 0, TreeOccupy, (void*)this, FL_MENU_TOGGLE | FL_MENU_VALUE);
+    _ids[14] = _menu3d->add("&Edit/Update Tracing\t", 0, TreeUpdate, (void*)this);
+    _ids[15] = _menu3d->add("&Edit/Cancel Tracing\t", FL_COMMAND+'e', TreeCancel, (void*)this);
+    _ids[16] = _menu3d->add("&Edit/Remove Last Tree\t", FL_Delete, TreeRemove, (void*)this);
+    _ids[17] = _menu3d->add("&Edit/Clear Tree\t", FL_SHIFT+FL_Delete, TreeClear, (void*)this);
+    _ids[18] = _menu3d->add("&Edit/Reduce Tree\t", FL_COMMAND+'r', TreeReduce, (void*)this);    
+    _ids[19] = _menu3d->add("&Edit/Prune Short Tree\t", 0, TreePrune, (void*)this);
+    _ids[20] = _menu3d->add("&Edit/Stretch Tree\t", 0, TreeStretch, (void*)this);
+    _ids[21] = _menu3d->add("&Edit/Fixup Thin Tree\t", 0, TreeFixup, (void*)this);
+
+    for (int i=0; i<22; ++i) _menu3d->mode(_ids[i], _menu3d->mode(_ids[i]) | FL_MENU_INACTIVE);
 
     _menu3d->add("&View/Perspective View\t", 0, ViewPersp, (void*)this, FL_MENU_TOGGLE | FL_MENU_DIVIDER);
     _menu3d->add("&View/Volume Style/Volume None\t", 0, VolumeNone, (void*)this, FL_MENU_RADIO);
@@ -93,7 +101,12 @@ Window::Window(int w, int h, const char *label)
 
     _menu3d->add("&Tool/Set Slice Thickness\t", 0, VolumeThickness, (void*)this);
     _menu3d->add("&Tool/Volume Down Sampling\t", 0, VolumeSample, (void*)this);
-    _menu3d->add("&Tool/Volume Color Mapping\t", 0, VolumeColormap, (void*)this, FL_MENU_DIVIDER);
+    _menu3d->add("&Tool/Save Volume Pyramid\t", 0, VolumePyramid, (void*)this);
+    _menu3d->add("&Tool/Volume Color Mapping\t", 0, VolumeColormap, (void*)this);
+    _menu3d->add("&Tool/Volume Preprocessing\t", 0, VolumePreprocess, (void*)this);
+    _menu3d->add("&Tool/Volume Depth Normalization\t", 0, VolumeNormalize, (void*)this);
+    _menu3d->add("&Tool/Benchmark Tracing Layout\t", 0, TreeBenchmark, (void*)this);
+    _menu3d->add("&Tool/Benchmark Remap Kernels\t", 0, RemapBenchmark, (void*)this, FL_MENU_DIVIDER);
     _menu3d->add("&Tool/Show Volume Information\t", 0, ShowVolume, (void*)this);
     _menu3d->add("&Tool/Show Soma Information\t", 0, ShowSoma, (void*)this);
     _menu3d->add("&Tool/Show Tree Information\t", 0, ShowTree, (void*)this);
@@ -118,6 +131,7 @@ Window::Window(int w, int h, const char *label)
     _menu2d->add("Insert Point\t", 0, ColorInsert, (void*)this);
     _menu2d->add("Remove Point\t", 0, ColorRemove, (void*)this, FL_MENU_DIVIDER);
     _menu2d->add("Update Volume\t", 0, ColorUpdate, (void*)this);
+    _menu2d->add("Bake Volume\t", 0, ColorBake, (void*)this);
     _menu2d->add("Reset Colormap\t", 0, ColorReset, (void*)this);
 
     _view2d->align(FL_ALIGN_BOTTOM_LEFT | FL_ALIGN_INSIDE);
@@ -154,24 +168,14 @@ void Window::FileLoad_i()
     Fl_Native_File_Chooser fc;
     fc.title("Load File");
     fc.type(Fl_Native_File_Chooser::BROWSE_FILE);
-    fc.filter("Volume File (*.tif)\t*.{tif}\nSoma File (*.apo)\t*.{apo}\nTree File (*.swc)\t*.{swc}\n");
+    fc.filter("Volume File (*.tif)\t*.{tif}\nSoma File (*.apo)\t*.{apo}\nTree File (*.swc)\t*.{swc}\nRaw Volume File (*.vol)\t*.{vol}\nBrick Volume File (*.brk)\t*.{brk}\nCompressed Brick Volume File (*.bkz)\t*.{bkz}\n");
     if (fc.show() == 0) {
         char path[256], ext[5];
         strcpy(path, fc.filename());
         strcpy(ext, fl_filename_ext(path));
         _strlwr(ext);
-        if (strcmp(ext, ".tif") == 0) {
-            char str[256];
-            sprintf(str, "flNeuronTool Tracing - loading %s ...", fl_filename_name(path));
-            label(str);
-            _volume->Read(path);
-            _volume->Show();            
-            _mapping->SetParam();
-            _probing->SetParam();
-            _tracing->SetParam();
-            _view3d->redraw();            
-            sprintf(str, "flNeuronTool Tracing - %s", fl_filename_name(path));
-            label(str);
+        if (strcmp(ext, ".tif") == 0 || strcmp(ext, ".vol") == 0 || strcmp(ext, ".brk") == 0 || strcmp(ext, ".bkz") == 0) {
+            _view3d->LoadVolume(path);
             return;
         }
         if (strcmp(ext, ".apo") == 0) {
@@ -194,7 +198,31 @@ void Window::FileLoad_i()
             _view3d->redraw();
             return;
         }
-        fl_alert("Unknown file type. Support volume (TIFF), soma (APO), tree (SWC) file.\n");
+        fl_alert("Unknown file type. Support volume (TIFF, VOL, BRK, BKZ), soma (APO), tree (SWC) file.\n");
+    }
+}
+
+void Window::FileRegion_i()
+{
+    Fl_Native_File_Chooser fc;
+    fc.title("Load File");
+    fc.type(Fl_Native_File_Chooser::BROWSE_FILE);
+    fc.filter("Volume File (*.tif)\t*.{tif}\n");
+    if (fc.show() == 0) {
+        char path[256];
+        strcpy(path, fc.filename());
+        const char *s = fl_input("Set volume region bounding box (x0 y0 z0 x1 y1 z1 value in voxel, inclusive).\n", "0 0 0 511 511 511");
+        if (s == 0) return;
+
+        size_t region[6];
+        int x0, y0, z0, x1, y1, z1;
+        if (sscanf(s, "%d %d %d %d %d %d", &x0, &y0, &z0, &x1, &y1, &z1) != 6 || x0 < 0 || y0 < 0 || z0 < 0 || x1 < x0 || y1 < y0 || z1 < z0) {
+            fl_alert("Invalid volume region bounding box.\n");
+            return;
+        }
+        region[0] = x0; region[1] = y0; region[2] = z0;
+        region[3] = x1; region[4] = y1; region[5] = z1;
+        _view3d->LoadVolume(path, region);
     }
 }
 
@@ -209,11 +237,15 @@ void Window::FileSave_i()
     fc.title("Save File");
     fc.type(Fl_Native_File_Chooser::BROWSE_SAVE_FILE);
     fc.options(fc.options() | Fl_Native_File_Chooser::SAVEAS_CONFIRM);
-    fc.filter("Volume File (*.tif)\t*.{tif}\nSoma File (*.apo)\t*.{apo}\nTree File (*.swc)\t*.{swc}\n");
+    fc.filter("Volume File (*.tif)\t*.{tif}\nSoma File (*.apo)\t*.{apo}\nTree File (*.swc)\t*.{swc}\nRaw Volume File (*.vol)\t*.{vol}\nBrick Volume File (*.brk)\t*.{brk}\nCompressed Brick Volume File (*.bkz)\t*.{bkz}\n");
     if (fc.show() == 0) {
         char path[256];
         strcpy(path, fc.filename());
         int fit = fc.filter_value();
+        if ((fit == 0 || fit >= 3) && _volume->IsLoading()) {
+            fl_alert("Please wait until the volume is loaded.\n");
+            return;
+        }
         if (fit == 0) {
             strcat(path, ".tif");
             _volume->Write(path);
@@ -237,7 +269,22 @@ void Window::FileSave_i()
             _tree->Write(path);
             return;
         }
-        fl_alert("Unknown file type. Support volume (TIFF), soma (APO), tree (SWC) file.\n");
+        if (fit == 3) {
+            strcat(path, ".vol");
+            _volume->Write(path);
+            return;
+        }
+        if (fit == 4) {
+            strcat(path, ".brk");
+            _volume->Write(path);
+            return;
+        }
+        if (fit == 5) {
+            strcat(path, ".bkz");
+            _volume->Write(path);
+            return;
+        }
+        fl_alert("Unknown file type. Support volume (TIFF, VOL, BRK, BKZ), soma (APO), tree (SWC) file.\n");
     }
 }
 
@@ -265,17 +312,17 @@ void Window::EditMode_i(OP_MODE mode)
 {
     _view3d->SetMode(mode);
     if (mode == OP_NONE) {
-        for (int i=0; i<21; ++i) _menu3d->mode(_ids[i], _menu3d->mode(_ids[i]) | FL_MENU_INACTIVE);
+        for (int i=0; i<22; ++i) _menu3d->mode(_ids[i], _menu3d->mode(_ids[i]) | FL_MENU_INACTIVE);
         printf("[Window::EditMode] switch to none filter mode\n");
     }
     else if (mode == OP_PROBING) {
         for (int i=0; i<9; ++i) _menu3d->mode(_ids[i], _menu3d->mode(_ids[i]) ^ FL_MENU_INACTIVE);
-        for (int i=9; i<21; ++i) _menu3d->mode(_ids[i], _menu3d->mode(_ids[i]) | FL_MENU_INACTIVE);
+        for (int i=9; i<22; ++i) _menu3d->mode(_ids[i], _menu3d->mode(_ids[i]) | FL_MENU_INACTIVE);
         printf("[Window::EditMode] switch to soma probing mode\n");
     }
     else if (mode == OP_TRACING) {
         for (int i=0; i<9; ++i) _menu3d->mode(_ids[i], _menu3d->mode(_ids[i]) | FL_MENU_INACTIVE);
-        for (int i=9; i<21; ++i) _menu3d->mode(_ids[i], _menu3d->mode(_ids[i]) ^ FL_MENU_INACTIVE);
+        for (int i=9; i<22; ++i) _menu3d->mode(_ids[i], _menu3d->mode(_ids[i]) ^ FL_MENU_INACTIVE);
         printf("[Window::EditMode] switch to tree tracing mode\n");
     }
 }
@@ -334,6 +381,20 @@ void Window::TreeParam_i()
     }
 }
 
+void Window::TreeLink_i(bool b)
+{
+    _tree->SetLink(b);
+    if (!b) return;
+
+    const char *s = fl_input("Set gap tree linking maximum distance (in voxels, 0 for no limit):\n", "0");
+    if (s != 0) {
+        float distance = 0.0f;
+        sscanf(s, "%f", &distance);
+        _tree->SetLinkDistance(distance);
+        printf("[Window::TreeLink] set gap tree linking maximum distance %.1f\n", _tree->GetLinkDistance());
+    }
+}
+
 void Window::TreeUpdate_i()
 {
     fl_message("Please select press mouse RIGHT button to select a seed point at desired position.\n");
@@ -387,6 +448,10 @@ void Window::TreeFixup_i()
 void Window::VolumeThickness_i()
 {
     if (!_volume->IsValid()) return;
+    if (_volume->IsLoading()) {
+        fl_alert("Please wait until the volume is loaded.\n");
+        return;
+    }
 
     char value[8];
     sprintf(value, "%.2f", _volume->GetThickness());
@@ -406,6 +471,10 @@ void Window::VolumeThickness_i()
 void Window::VolumeSample_i()
 {
     if (!_volume->IsValid()) return;
+    if (_volume->IsLoading()) {
+        fl_alert("Please wait until the volume is loaded.\n");
+        return;
+    }
 
     const char *s = fl_input("Set volume down sampling level (1/2/4) for rendering. Default is 1.\n", "1");
     if (s != 0) {
@@ -416,6 +485,70 @@ void Window::VolumeSample_i()
     }
 }
 
+void Window::VolumePreprocess_i()
+{
+    if (!_volume->IsValid()) return;
+    if (_volume->IsBricked() || _volume->IsLoading()) {
+        fl_alert("Preprocessing needs a loaded in-memory volume.\n");
+        return;
+    }
+
+    const char *s = fl_input("Set volume preprocessing chain, run in order before tracing.\ng<sigma> Gaussian, m<radius> median, t<radius> top-hat background subtraction.\n", "g1 t12");
+    if (s != 0) {
+        Preprocess chain;
+        if (!chain.SetChain(s)) {
+            fl_alert("Unknown preprocessing step.\n");
+            return;
+        }
+        _view3d->make_current();
+        _volume->Filter(chain);
+        _view3d->redraw();
+        _view2d->redraw();
+        _mapping->SetParam();
+        _probing->SetParam();
+        _tracing->SetParam();
+    }
+}
+
+void Window::VolumeNormalize_i()
+{
+    if (!_volume->IsValid()) return;
+    if (_volume->IsBricked() || _volume->IsLoading()) {
+        fl_alert("Normalization needs a loaded in-memory volume.\n");
+        return;
+    }
+
+    // percentiles stretch the 1%-99% range of each slice, histograms match the whole distribution
+    int mode = fl_choice("Normalize slice intensities against the whole volume by matching", "Cancel", "Percentiles", "Histograms");
+    if (mode == 0) return;
+    const char *s = fl_input("Set normalization slab (slices around each slice, 1 for per slice).\n", "1");
+    if (s != 0) {
+        int slab = atoi(s);
+        _view3d->make_current();
+        _volume->Normalize((mode == 1) ? NORM_PERCENTILE : NORM_HISTOGRAM, (slab > 1) ? (size_t)slab : 1);
+        _view3d->redraw();
+        _view2d->redraw();
+        _mapping->SetParam();
+        _probing->SetParam();
+        _tracing->SetParam();
+    }
+}
+
+void Window::VolumePyramid_i()
+{
+    if (_volume->IsLoading()) {
+        fl_alert("Please wait until the volume is loaded.\n");
+        return;
+    }
+    if (!_volume->IsValid() || _volume->GetLevels() <= 1) {
+        fl_alert("No volume pyramid to save.\n");
+        return;
+    }
+
+    // saved as <volume file>.pyr, the pyramid is reused when the same volume file is loaded again
+    if (!_volume->WritePyramid()) fl_alert("Volume pyramid can only be saved next to a whole volume file whose voxels are not edited since read.\n");
+}
+
 void Window::ColorLoad_i()
 {
     Fl_Native_File_Chooser fc;
@@ -482,12 +615,26 @@ void Window::ColorUpdate_i()
     _tracing->SetParam();
 }
 
+void Window::ColorBake_i()
+{
+    if (_volume->IsLoading()) {
+        fl_alert("Please wait until the volume is loaded.\n");
+        return;
+    }
+    _view3d->make_current();
+    _mapping->Bake();
+    _view3d->redraw();
+    _view2d->redraw();
+}
+
 void Window::ColorReset_i()
 {
     _view3d->make_current();
     _mapping->Reset();
     _view3d->redraw();
     _view2d->redraw();
+    _probing->SetParam();
+    _tracing->SetParam();
 }
 
 void Window::About_i()
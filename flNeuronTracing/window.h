@@ -16,8 +16,15 @@ public:
 
 private:
     static void FileLoad(Fl_Widget *obj, void *data) { ((Window*)data)->FileLoad_i(); }
+    static void FileRegion(Fl_Widget *obj, void *data) { ((Window*)data)->FileRegion_i(); }
     static void FileSave(Fl_Widget *obj, void *data) { ((Window*)data)->FileSave_i(); }
     static void SceneSave(Fl_Widget *obj, void *data) { ((Window*)data)->SceneSave_i(); }
+    static void CodecNone(Fl_Widget *obj, void *data) { ((Window*)data)->VolumeCodec_i(TIF_NONE); }
+    static void CodecPackBits(Fl_Widget *obj, void *data) { ((Window*)data)->VolumeCodec_i(TIF_PACKBITS); }
+    static void CodecLZW(Fl_Widget *obj, void *data) { ((Window*)data)->VolumeCodec_i(TIF_LZW); }
+    static void CodecDeflate(Fl_Widget *obj, void *data) { ((Window*)data)->VolumeCodec_i(TIF_DEFLATE); }
+    static void LayoutLinear(Fl_Widget *obj, void *data) { ((Window*)data)->VolumeLayout_i(VOX_LINEAR); }
+    static void LayoutBrick(Fl_Widget *obj, void *data) { ((Window*)data)->VolumeLayout_i(VOX_BRICK); }
     static void Quit(Fl_Widget *obj, void *data) { exit(0); }  
 
     static void EditNone(Fl_Widget *obj, void *data) { ((Window*)data)->EditMode_i(OP_NONE); }
@@ -38,6 +45,7 @@ private:
     static void TreeParam(Fl_Widget *obj, void *data) { ((Window*)data)->TreeParam_i(); }
     static void TreeLocal(Fl_Widget *obj, void *data) { ((Window*)data)->TreeLocal_i(((Fl_Menu_*)obj)->mvalue()->value()==FL_MENU_VALUE); }
     static void TreeLink(Fl_Widget *obj, void *data) { ((Window*)data)->TreeLink_i(((Fl_Menu_*)obj)->mvalue()->value()==FL_MENU_VALUE); }
+    static void TreeOccupy(Fl_Widget *obj, void *data) { ((Window*)data)->TreeOccupy_i(((Fl_Menu_*)obj)->mvalue()->value()==FL_MENU_VALUE); }
     static void TreeUpdate(Fl_Widget *obj, void *data) { ((Window*)data)->TreeUpdate_i(); }
     static void TreeCancel(Fl_Widget *obj, void *data) { ((Window*)data)->TreeCancel_i(); }
     static void TreeRemove(Fl_Widget *obj, void *data) { ((Window*)data)->TreeRemove_i(); }
@@ -68,7 +76,12 @@ private:
 
     static void VolumeThickness(Fl_Widget *obj, void *data) { ((Window*)data)->VolumeThickness_i(); }
     static void VolumeSample(Fl_Widget *obj, void *data) { ((Window*)data)->VolumeSample_i(); }
+    static void VolumePyramid(Fl_Widget *obj, void *data) { ((Window*)data)->VolumePyramid_i(); }
     static void VolumeColormap(Fl_Widget *obj, void *data) { ((Window*)data)->VolumeColormap_i(); }
+    static void VolumePreprocess(Fl_Widget *obj, void *data) { ((Window*)data)->VolumePreprocess_i(); }
+    static void VolumeNormalize(Fl_Widget *obj, void *data) { ((Window*)data)->VolumeNormalize_i(); }
+    static void TreeBenchmark(Fl_Widget *obj, void *data) { ((Window*)data)->TreeBenchmark_i(); }
+    static void RemapBenchmark(Fl_Widget *obj, void *data) { ((Window*)data)->RemapBenchmark_i(); }
     static void ShowVolume(Fl_Widget *obj, void *data) { ((Window*)data)->ShowVolume_i(); }
     static void ShowSoma(Fl_Widget *obj, void *data) { ((Window*)data)->ShowSoma_i(); }
     static void ShowTree(Fl_Widget *obj, void *data) { ((Window*)data)->ShowTree_i(); }
@@ -78,12 +91,14 @@ private:
     static void ColorInsert(Fl_Widget *obj, void *data) { ((Window*)data)->ColorInsert_i(); }
     static void ColorRemove(Fl_Widget *obj, void *data) { ((Window*)data)->ColorRemove_i(); }
     static void ColorUpdate(Fl_Widget *obj, void *data) { ((Window*)data)->ColorUpdate_i(); }
+    static void ColorBake(Fl_Widget *obj, void *data) { ((Window*)data)->ColorBake_i(); }
     static void ColorReset(Fl_Widget *obj, void *data) { ((Window*)data)->ColorReset_i(); }
 
     static void About(Fl_Widget *obj, void *data) { ((Window*)data)->About_i(); }
 
 private:
     void FileLoad_i();
+    void FileRegion_i();
     void FileSave_i();
     void SceneSave_i();
 
@@ -102,7 +117,8 @@ private:
     void TreeSampling_i();
     void TreeParam_i();
     void TreeLocal_i(bool b) { _tracing->SetLocal(b); }
-    void TreeLink_i(bool b) { _tree->SetLink(b); } 
+    void TreeLink_i(bool b);
+    void TreeOccupy_i(bool b) { _tracing->SetOccupy(b); }
     void TreeUpdate_i();
     void TreeCancel_i() { _tracing->CancelUpdate(); _view3d->redraw(); }
     void TreeRemove_i() { _tree->Remove(); _view3d->redraw(); }
@@ -114,6 +130,8 @@ private:
 
     void VolumeBound_i(bool b) { _volume->SetBound(b); _view3d->redraw(); }
     void VolumeStyle_i(VOL_STYLE style) { _volume->SetStyle(style); _view3d->redraw(); }
+    void VolumeCodec_i(TIF_CODEC codec) { _volume->SetCodec(codec); }
+    void VolumeLayout_i(VOX_LAYOUT layout) { _volume->SetLayout(layout); }
     void SomaStyle_i(APO_STYLE style) { _soma->SetStyle(style); _view3d->redraw(); }
     void TreeStyle_i(SWC_STYLE style) { _tree->SetStyle(style); _view3d->redraw(); }
     void ViewPersp_i(bool b) { _view3d->SetPersp(b); }
@@ -121,7 +139,12 @@ private:
 
     void VolumeThickness_i();
     void VolumeSample_i();    
+    void VolumePyramid_i();
     void VolumeColormap_i() { if (_volume->IsValid()) _dialog->show(); }
+    void VolumePreprocess_i();
+    void VolumeNormalize_i();
+    void TreeBenchmark_i() { _tracing->BeginBenchmark(); }
+    void RemapBenchmark_i() { Remap::Benchmark(); }
     void ShowVolume_i() { if (_volume->IsValid()) _volume->Show(); }
     void ShowSoma_i() { if (_soma->IsValid()) _soma->Show(); }
     void ShowTree_i() { if (_tree->IsValid()) _tree->Show(); }
@@ -131,6 +154,7 @@ private:
     void ColorInsert_i() { _view2d->InsertPoint(); }
     void ColorRemove_i() { _view2d->RemovePoint(); }
     void ColorUpdate_i();
+    void ColorBake_i();
     void ColorReset_i();
 
     void About_i();